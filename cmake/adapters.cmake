@@ -1,6 +1,17 @@
+# Optional hooks only go into an adapter's info if they're listed in its GVOX_<KIND>_ADAPTER_<NAME>_HOOKS. The rest
+# are left null, so that the core falls back to the required functions for them.
+function(gvox_optional_adapter_hook KIND NAME HOOK OUT_VAR)
+    string(TOUPPER "${KIND}" KIND_UPPER)
+    if(HOOK IN_LIST GVOX_${KIND_UPPER}_ADAPTER_${NAME}_HOOKS)
+        set(${OUT_VAR} "gvox_${KIND}_adapter_${NAME}_${HOOK}" PARENT_SCOPE)
+    else()
+        set(${OUT_VAR} "nullptr" PARENT_SCOPE)
+    endif()
+endfunction()
 
 foreach(NAME ${GVOX_INPUT_ADAPTERS})
     target_sources(${PROJECT_NAME} PRIVATE "src/adapters/input/${NAME}.cpp")
+    gvox_optional_adapter_hook(input ${NAME} view VIEW_FN)
     set(INPUT_ADAPTER_NAMES_CONTENT "${INPUT_ADAPTER_NAMES_CONTENT}
     \"${NAME}\",")
     set(INPUT_ADAPTER_INFOS_CONTENT "${INPUT_ADAPTER_INFOS_CONTENT}
@@ -13,6 +24,7 @@ foreach(NAME ${GVOX_INPUT_ADAPTERS})
             .blit_end = gvox_input_adapter_${NAME}_blit_end,
         },
         .read = gvox_input_adapter_${NAME}_read,
+        .view = ${VIEW_FN},
     },")
 endforeach()
     foreach(NAME ${GVOX_OUTPUT_ADAPTERS})
@@ -34,6 +46,9 @@ endforeach()
 endforeach()
     foreach(NAME ${GVOX_PARSE_ADAPTERS})
     target_sources(${PROJECT_NAME} PRIVATE "src/adapters/parse/${NAME}.cpp")
+    gvox_optional_adapter_hook(parse ${NAME} sample_region_batch SAMPLE_REGION_BATCH_FN)
+    gvox_optional_adapter_hook(parse ${NAME} load_region_dense LOAD_REGION_DENSE_FN)
+    gvox_optional_adapter_hook(parse ${NAME} sample_region_channels SAMPLE_REGION_CHANNELS_FN)
     set(PARSE_ADAPTER_NAMES_CONTENT "${PARSE_ADAPTER_NAMES_CONTENT}
     \"${NAME}\",")
     set(PARSE_ADAPTER_INFOS_CONTENT "${PARSE_ADAPTER_INFOS_CONTENT}
@@ -55,6 +70,10 @@ endforeach()
         .unload_region = gvox_parse_adapter_${NAME}_unload_region,
 
         .parse_region = gvox_parse_adapter_${NAME}_parse_region,
+
+        .sample_region_batch = ${SAMPLE_REGION_BATCH_FN},
+        .load_region_dense = ${LOAD_REGION_DENSE_FN},
+        .sample_region_channels = ${SAMPLE_REGION_CHANNELS_FN},
     },")
 endforeach()
     foreach(NAME ${GVOX_SERIALIZE_ADAPTERS})
@@ -74,6 +93,8 @@ endforeach()
         .serialize_region = gvox_serialize_adapter_${NAME}_serialize_region,
 
         .receive_region = gvox_serialize_adapter_${NAME}_receive_region,
+
+        .query_details = gvox_serialize_adapter_${NAME}_query_details,
     },")
 endforeach()
 
@@ -104,6 +125,7 @@ extern \"C\" void gvox_input_adapter_${NAME}_blit_begin(GvoxBlitContext *blit_ct
 extern \"C\" void gvox_input_adapter_${NAME}_blit_end(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx);
 
 extern \"C\" void gvox_input_adapter_${NAME}_read(GvoxAdapterContext *ctx, size_t position, size_t size, void *data);
+extern \"C\" auto gvox_input_adapter_${NAME}_view(GvoxAdapterContext *ctx, size_t position, size_t size) -> void const *;
 ")
 endforeach()
     foreach(NAME ${GVOX_OUTPUT_ADAPTERS})
@@ -139,6 +161,10 @@ extern \"C\" auto gvox_parse_adapter_${NAME}_load_region(GvoxBlitContext *blit_c
 extern \"C\" void gvox_parse_adapter_${NAME}_unload_region(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion *region);
 
 extern \"C\" void gvox_parse_adapter_${NAME}_parse_region(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t channel_flags);
+
+extern \"C\" void gvox_parse_adapter_${NAME}_sample_region_batch(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion const *region, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_id);
+extern \"C\" auto gvox_parse_adapter_${NAME}_load_region_dense(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t channel_id, uint32_t *data, GvoxStrides3D const *strides) -> uint8_t;
+extern \"C\" void gvox_parse_adapter_${NAME}_sample_region_channels(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion const *region, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_flags);
 ")
 endforeach()
 foreach(NAME ${GVOX_SERIALIZE_ADAPTERS})
@@ -154,6 +180,8 @@ extern \"C\" void gvox_serialize_adapter_${NAME}_blit_end(GvoxBlitContext *blit_
 extern \"C\" void gvox_serialize_adapter_${NAME}_serialize_region(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t channel_flags);
 
 extern \"C\" void gvox_serialize_adapter_${NAME}_receive_region(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion const *region);
+
+extern \"C\" auto gvox_serialize_adapter_${NAME}_query_details() -> GvoxSerializeAdapterDetails;
 ")
 endforeach()
 
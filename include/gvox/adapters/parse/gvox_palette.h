@@ -1,6 +1,15 @@
 #ifndef GVOX_GVOX_PALETTE_PARSE_ADAPTER_H
 #define GVOX_GVOX_PALETTE_PARSE_ADAPTER_H
 
-// This adapter has no config
+typedef struct {
+    // By default, this is 64.
+    // The number of decoded bricks each sampling thread keeps around, so that
+    // repeated samples within a brick don't decode it again. 0 disables the cache.
+    // Each channel of a brick is cached (and counted) separately, and costs
+    // brick_size^3 * 4 bytes: 2KiB for 8^3 bricks, 16KiB for 16^3 and 128KiB
+    // for 32^3. With 32^3 bricks, the default of 64 comes to about 8MiB per
+    // thread in total.
+    uint32_t decoded_brick_cache_size;
+} GvoxGvoxPaletteParseAdapterConfig;
 
 #endif
@@ -3,4 +3,17 @@
 
 // This adapter has no config
 
+// When the input can be viewed in place (see gvox_input_view), the `data` of every region this adapter loads or emits
+// points to one of these, which stays valid until the end of the blit. The k-th channel set in `channel_flags` of the
+// voxel at `p` is at `voxels[k * channel_stride + (p.x - range.offset.x) * strides.x + (p.y - range.offset.y) * strides.y +
+// (p.z - range.offset.z) * strides.z]`. Rows of interleaved files are contiguous across all channels, and rows of planar
+// files are contiguous within each channel.
+typedef struct {
+    uint32_t const *voxels;
+    GvoxRegionRange range;
+    uint32_t channel_flags;
+    GvoxStrides3D strides;
+    size_t channel_stride;
+} GvoxGvoxRawParseRegionData;
+
 #endif
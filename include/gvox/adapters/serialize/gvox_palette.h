@@ -1,6 +1,36 @@
 #ifndef GVOX_GVOX_PALETTE_SERIALIZE_ADAPTER_H
 #define GVOX_GVOX_PALETTE_SERIALIZE_ADAPTER_H
 
-// This adapter has no config
+typedef enum {
+    GVOX_GVOX_PALETTE_SERIALIZE_ADAPTER_COMPRESSION_NONE,
+    GVOX_GVOX_PALETTE_SERIALIZE_ADAPTER_COMPRESSION_LZ,
+} GvoxGvoxPaletteSerializeAdapterCompression;
+
+typedef struct {
+    // By default, this is 1.
+    // The version of the format to write. Version 1 can be read by older
+    // versions of gvox and has the smallest headers, but can't hold more
+    // than 4GiB of brick data. Version 2 lifts that limit and allows
+    // compression, and version 3 also allows bigger bricks. Version 3
+    // files with 8 voxel bricks are written as version 2.
+    uint32_t version;
+    // By default, this is ..._NONE.
+    // Each brick is compressed on its own, so bricks can still be loaded and
+    // decoded independently. Bricks that don't get smaller are stored as is.
+    // Requires version 2.
+    GvoxGvoxPaletteSerializeAdapterCompression compression;
+    // By default, this is 0.
+    // When non-zero, bricks are written out one z slab at a time as soon as
+    // the slab is complete, so that memory use stays proportional to a slab
+    // rather than the whole range. Only serialize driven blits can stream,
+    // and duplicate bricks are only shared within a slab.
+    uint8_t streaming;
+    // By default, this is 8.
+    // The width of a brick in voxels: 8, 16 or 32 (0 also means 8).
+    // Bigger bricks store large uniform areas more compactly, but cost
+    // more to decode when only a few of their voxels are needed. Sizes
+    // other than 8 require version 3.
+    uint32_t brick_size;
+} GvoxGvoxPaletteSerializeAdapterConfig;
 
 #endif
@@ -1,6 +1,30 @@
 #ifndef GVOX_GVOX_RAW_SERIALIZE_ADAPTER_H
 #define GVOX_GVOX_RAW_SERIALIZE_ADAPTER_H
 
-// This adapter has no config
+typedef enum {
+    GVOX_GVOX_RAW_SERIALIZE_ADAPTER_LAYOUT_INTERLEAVED,
+    GVOX_GVOX_RAW_SERIALIZE_ADAPTER_LAYOUT_PLANAR,
+} GvoxGvoxRawSerializeAdapterLayout;
+
+typedef struct {
+    // By default, this is ..._INTERLEAVED.
+    // Interleaved files store all the channels of a voxel next to each
+    // other. Planar files store one contiguous plane per channel instead,
+    // so a single channel can be read without striding past the others.
+    // Planar files can't be read by older versions of gvox.
+    GvoxGvoxRawSerializeAdapterLayout layout;
+    // By default, this is 0.
+    // When non-zero, voxels are written out one z slab at a time as soon as
+    // the slab is complete, instead of all at once in blit_end, so that
+    // memory use stays proportional to a few slabs rather than the whole
+    // range. Only serialize driven blits can stream, and planar files are
+    // never streamed, since their slabs aren't contiguous in the file.
+    uint8_t streaming;
+    // By default, this is 16.
+    // The depth of a slab in z slices when streaming, rounded up to a
+    // multiple of 16 (0 also means 16). Deeper slabs make for fewer and
+    // bigger writes, at the cost of memory.
+    uint32_t slab_size;
+} GvoxGvoxRawSerializeAdapterConfig;
 
 #endif
@@ -95,10 +95,24 @@ typedef struct {
     uint8_t is_present;
 } GvoxSample;
 
+// Element (not byte) strides of a dense voxel buffer
+typedef struct {
+    size_t x;
+    size_t y;
+    size_t z;
+} GvoxStrides3D;
+
 typedef struct {
     GvoxBlitMode preferred_blit_mode;
+    // Set to 1 if load_region, unload_region and all the sampling functions may be called from several threads at once
+    uint8_t supports_concurrent_sampling;
 } GvoxParseAdapterDetails;
 
+typedef struct {
+    // Set to 1 if serialize_region may be called from several threads at once, with disjoint ranges
+    uint8_t supports_concurrent_serialization;
+} GvoxSerializeAdapterDetails;
+
 typedef struct {
     char const *name_str;
     void (*create)(GvoxAdapterContext *ctx, void const *config);
@@ -110,6 +124,8 @@ typedef struct {
 typedef struct {
     GvoxAdapterBaseInfo base_info;
     void (*read)(GvoxAdapterContext *ctx, size_t position, size_t size, void *data);
+    // Optional. Returns the bytes [position, position + size) in place, or null if they can't be provided without a copy
+    void const *(*view)(GvoxAdapterContext *ctx, size_t position, size_t size);
 } GvoxInputAdapterInfo;
 
 typedef struct {
@@ -130,6 +146,10 @@ typedef struct {
     void (*unload_region)(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion *region);
     // Parse Driven
     void (*parse_region)(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t channel_flags);
+    // Optional (may be null, in which case the core falls back to the functions above)
+    void (*sample_region_batch)(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion const *region, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_id);
+    uint8_t (*load_region_dense)(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t channel_id, uint32_t *data, GvoxStrides3D const *strides);
+    void (*sample_region_channels)(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion const *region, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_flags);
 } GvoxParseAdapterInfo;
 
 typedef struct {
@@ -138,10 +158,15 @@ typedef struct {
     void (*serialize_region)(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t channel_flags);
     // Parse Driven
     void (*receive_region)(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion const *region);
+    // Optional
+    GvoxSerializeAdapterDetails (*query_details)(void);
 } GvoxSerializeAdapterInfo;
 
 GVOX_EXPORT GvoxContext *gvox_create_context(void);
 GVOX_EXPORT void gvox_destroy_context(GvoxContext *ctx);
+// Sizes the worker pool shared by every blit on this context. 0 (the default) uses one thread per hardware thread.
+// Must not be called while a blit on this context is in progress.
+GVOX_EXPORT void gvox_context_set_thread_count(GvoxContext *ctx, uint32_t thread_count);
 
 GVOX_EXPORT GvoxResult gvox_get_result(GvoxContext *ctx);
 GVOX_EXPORT void gvox_get_result_message(GvoxContext *ctx, char *const str_buffer, size_t *str_size);
@@ -177,18 +202,37 @@ GVOX_EXPORT void gvox_blit_region_serialize_driven(
     GvoxAdapterContext *parse_ctx, GvoxAdapterContext *serialize_ctx,
     GvoxRegionRange const *requested_range, uint32_t channel_flags);
 
+// Serialize driven, but the range is split into tiles which are serialized on multiple threads. This falls back
+// to gvox_blit_region if either the parse or serialize adapter doesn't declare support for concurrent use.
+GVOX_EXPORT void gvox_blit_region_parallel(
+    GvoxAdapterContext *input_ctx, GvoxAdapterContext *output_ctx,
+    GvoxAdapterContext *parse_ctx, GvoxAdapterContext *serialize_ctx,
+    GvoxRegionRange const *requested_range, uint32_t channel_flags);
+
 // Adapter API
 
 GVOX_EXPORT uint32_t gvox_query_region_flags(GvoxBlitContext *blit_ctx, GvoxRegionRange const *range, uint32_t channel_flags);
 GVOX_EXPORT GvoxRegion gvox_load_region_range(GvoxBlitContext *blit_ctx, GvoxRegionRange const *range, uint32_t channel_flags);
 GVOX_EXPORT void gvox_unload_region_range(GvoxBlitContext *blit_ctx, GvoxRegion *region, GvoxRegionRange const *range);
 GVOX_EXPORT GvoxSample gvox_sample_region(GvoxBlitContext *blit_ctx, GvoxRegion const *region, GvoxOffset3D const *offset, uint32_t channel_id);
+// Samples `sample_n` voxels at once, writing the result for `offsets[i]` into `samples[i]`
+GVOX_EXPORT void gvox_sample_region_batch(GvoxBlitContext *blit_ctx, GvoxRegion const *region, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_id);
+// Samples every channel set in `channel_flags` at each offset. The samples are interleaved, meaning the k-th set
+// channel of `offsets[i]` is written to `samples[i * channel_n + k]`, where channel_n is the number of set channels
+GVOX_EXPORT void gvox_sample_region_channels(GvoxBlitContext *blit_ctx, GvoxRegion const *region, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_flags);
+// Writes every voxel of `range` into `data`, at `x * strides->x + y * strides->y + z * strides->z` relative to the range
+// offset. A null `strides` means the buffer is tightly packed. Voxels that aren't present are written as 0.
+// Returns 1 if every voxel was present, and 0 otherwise.
+GVOX_EXPORT uint8_t gvox_load_region_dense(GvoxBlitContext *blit_ctx, GvoxRegionRange const *range, uint32_t channel_id, uint32_t *data, GvoxStrides3D const *strides);
 
 GVOX_EXPORT void gvox_adapter_push_error(GvoxAdapterContext *ctx, GvoxResult result_code, char const *message);
 GVOX_EXPORT void gvox_adapter_set_user_pointer(GvoxAdapterContext *ctx, void *ptr);
 GVOX_EXPORT void *gvox_adapter_get_user_pointer(GvoxAdapterContext *ctx);
 
 GVOX_EXPORT void gvox_input_read(GvoxBlitContext *blit_ctx, size_t position, size_t size, void *data);
+// Returns the input bytes [position, position + size) without copying them, or null if the input adapter can't do
+// that, in which case gvox_input_read has to be used instead. The pointer stays valid until the end of the blit.
+GVOX_EXPORT void const *gvox_input_view(GvoxBlitContext *blit_ctx, size_t position, size_t size);
 GVOX_EXPORT void gvox_output_write(GvoxBlitContext *blit_ctx, size_t position, size_t size, void const *data);
 GVOX_EXPORT void gvox_output_reserve(GvoxBlitContext *blit_ctx, size_t size);
 
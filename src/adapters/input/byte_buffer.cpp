@@ -43,3 +43,11 @@ extern "C" void gvox_input_adapter_byte_buffer_read(GvoxAdapterContext *ctx, siz
     }
     std::copy(user_state.bytes.data() + position, user_state.bytes.data() + position + size, static_cast<uint8_t *>(data));
 }
+
+extern "C" auto gvox_input_adapter_byte_buffer_view(GvoxAdapterContext *ctx, size_t position, size_t size) -> void const * {
+    auto &user_state = *static_cast<ByteBufferInputUserState *>(gvox_adapter_get_user_pointer(ctx));
+    if (position + size > user_state.bytes.size()) {
+        return nullptr;
+    }
+    return user_state.bytes.data() + position;
+}
@@ -13,10 +13,23 @@
 #include <mutex>
 #endif
 
+// Where it's available, the file is also mapped into memory, so that parsers can view it without copying
+#if defined(__unix__) || defined(__APPLE__)
+#define GVOX_FILE_INPUT_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define GVOX_FILE_INPUT_MMAP 0
+#endif
+
 struct FileInputUserState {
     std::filesystem::path path{};
     std::ifstream file{};
     size_t byte_offset{};
+    void const *mapped_data{};
+    size_t mapped_size{};
 #if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
     std::mutex mtx{};
 #endif
@@ -41,11 +54,34 @@ extern "C" void gvox_input_adapter_file_destroy(GvoxAdapterContext *ctx) {
 extern "C" void gvox_input_adapter_file_blit_begin(GvoxBlitContext * /*unused*/, GvoxAdapterContext *ctx, GvoxRegionRange const * /*unused*/, uint32_t /*unused*/) {
     auto &user_state = *static_cast<FileInputUserState *>(gvox_adapter_get_user_pointer(ctx));
     user_state.file.open(user_state.path, std::ios::binary);
+#if GVOX_FILE_INPUT_MMAP
+    // If mapping fails, views just aren't available, and everything goes through read
+    auto fd = open(user_state.path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    struct stat file_stat {};
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+        auto *mapped_data = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped_data != MAP_FAILED) {
+            user_state.mapped_data = mapped_data;
+            user_state.mapped_size = static_cast<size_t>(file_stat.st_size);
+        }
+    }
+    close(fd);
+#endif
 }
 
 extern "C" void gvox_input_adapter_file_blit_end(GvoxBlitContext * /*unused*/, GvoxAdapterContext *ctx) {
     auto &user_state = *static_cast<FileInputUserState *>(gvox_adapter_get_user_pointer(ctx));
     user_state.file.close();
+#if GVOX_FILE_INPUT_MMAP
+    if (user_state.mapped_data != nullptr) {
+        munmap(const_cast<void *>(user_state.mapped_data), user_state.mapped_size);
+    }
+#endif
+    user_state.mapped_data = nullptr;
+    user_state.mapped_size = 0;
 }
 
 // General
@@ -57,3 +93,11 @@ extern "C" void gvox_input_adapter_file_read(GvoxAdapterContext *ctx, size_t pos
     user_state.file.seekg(static_cast<std::streamoff>(position), std::ios_base::beg);
     user_state.file.read(static_cast<char *>(data), static_cast<std::streamsize>(size));
 }
+
+extern "C" auto gvox_input_adapter_file_view(GvoxAdapterContext *ctx, size_t position, size_t size) -> void const * {
+    auto &user_state = *static_cast<FileInputUserState *>(gvox_adapter_get_user_pointer(ctx));
+    if (user_state.mapped_data == nullptr || position + size > user_state.mapped_size) {
+        return nullptr;
+    }
+    return static_cast<uint8_t const *>(user_state.mapped_data) + position;
+}
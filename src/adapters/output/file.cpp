@@ -7,12 +7,22 @@
 #include <algorithm>
 #include <filesystem>
 #include <fstream>
-#include <vector>
 #include <new>
 
+#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
+#include <mutex>
+#endif
+
+// Writes go straight to the file at their position, so serializers that stream their output out don't end up
+// with all of it in memory here instead
 struct OutputFileUserState {
     std::filesystem::path path{};
-    std::vector<uint8_t> bytes{};
+    std::ofstream file{};
+    size_t size{};
+    size_t written_size{};
+#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
+    std::mutex mtx{};
+#endif
 };
 
 // Base
@@ -34,26 +44,39 @@ extern "C" void gvox_output_adapter_file_destroy(GvoxAdapterContext *ctx) {
     free(&user_state);
 }
 
-extern "C" void gvox_output_adapter_file_blit_begin(GvoxBlitContext * /*unused*/, GvoxAdapterContext * /*unused*/, GvoxRegionRange const * /*unused*/, uint32_t /*unused*/) {
+extern "C" void gvox_output_adapter_file_blit_begin(GvoxBlitContext * /*unused*/, GvoxAdapterContext *ctx, GvoxRegionRange const * /*unused*/, uint32_t /*unused*/) {
+    auto &user_state = *static_cast<OutputFileUserState *>(gvox_adapter_get_user_pointer(ctx));
+    user_state.file.open(user_state.path, std::ios_base::binary | std::ios_base::trunc);
+    user_state.size = 0;
+    user_state.written_size = 0;
 }
 
 extern "C" void gvox_output_adapter_file_blit_end(GvoxBlitContext * /*unused*/, GvoxAdapterContext *ctx) {
     auto &user_state = *static_cast<OutputFileUserState *>(gvox_adapter_get_user_pointer(ctx));
-    auto file = std::ofstream(user_state.path, std::ios_base::binary);
-    file.write(reinterpret_cast<char const *>(user_state.bytes.data()), static_cast<std::streamsize>(user_state.bytes.size()));
+    // Space that was reserved but never written still has to end up in the file, as zeros
+    if (user_state.size > user_state.written_size) {
+        user_state.file.seekp(static_cast<std::streamoff>(user_state.size - 1), std::ios_base::beg);
+        user_state.file.put(0);
+    }
+    user_state.file.close();
 }
 
 // General
 extern "C" void gvox_output_adapter_file_reserve(GvoxAdapterContext *ctx, size_t size) {
     auto &user_state = *static_cast<OutputFileUserState *>(gvox_adapter_get_user_pointer(ctx));
-    if (size > user_state.bytes.size()) {
-        user_state.bytes.resize(size);
-    }
+#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
+    auto lock = std::lock_guard{user_state.mtx};
+#endif
+    user_state.size = std::max(user_state.size, size);
 }
 
 extern "C" void gvox_output_adapter_file_write(GvoxAdapterContext *ctx, size_t position, size_t size, void const *data) {
     auto &user_state = *static_cast<OutputFileUserState *>(gvox_adapter_get_user_pointer(ctx));
-    gvox_output_adapter_file_reserve(ctx, position + size);
-    const auto *bytes = static_cast<uint8_t const *>(data);
-    std::copy(bytes, bytes + size, user_state.bytes.data() + position);
+#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
+    auto lock = std::lock_guard{user_state.mtx};
+#endif
+    user_state.file.seekp(static_cast<std::streamoff>(position), std::ios_base::beg);
+    user_state.file.write(static_cast<char const *>(data), static_cast<std::streamsize>(size));
+    user_state.size = std::max(user_state.size, position + size);
+    user_state.written_size = std::max(user_state.written_size, position + size);
 }
@@ -2,40 +2,171 @@
 #include <gvox/adapters/parse/gvox_palette.h>
 
 #include "../shared/gvox_palette.hpp"
+#include "../shared/lz.hpp"
 
 #include <cstdlib>
 #include <cstring>
 
 #include <bit>
+#include <array>
 #include <vector>
+#include <algorithm>
+#include <utility>
 #include <new>
+#include <atomic>
+#include <memory>
 
-struct LoadedRegionHeader {
-    std::vector<ChannelHeader> channels;
+#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
+#include <mutex>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+struct UniformNode {
+    uint32_t value;
+    uint32_t is_uniform;
+};
+
+// One level of the uniform value pyramid over the brick grid. Level 0 has a node per brick, and each level above
+// halves the grid along every axis, a node being uniform if all of its children are, with the same value.
+struct UniformLevel {
+    uint32_t nx;
+    uint32_t ny;
+    uint32_t nz;
+    // Indexed by node_index * channel_n + channel_index, like the headers
+    std::vector<UniformNode> nodes;
 };
 
 struct GvoxPaletteParseUserState {
+    GvoxGvoxPaletteParseAdapterConfig config{};
+    // Identifies this blit's data to the per-thread decoded brick caches
+    uint64_t cache_id{};
+
     GvoxRegionRange range{};
-    uint32_t blob_size{};
+    uint64_t blob_size{};
     uint32_t channel_flags{};
     uint32_t channel_n{};
+    uint32_t region_size{};
 
     size_t offset{};
     uint32_t r_nx{};
     uint32_t r_ny{};
     uint32_t r_nz{};
 
-    std::vector<LoadedRegionHeader> region_headers{};
-    std::vector<uint8_t> buffer{};
+    // One per channel of each brick, indexed by brick_index * channel_n + channel_index. Version 1 headers are
+    // widened on load.
+    std::vector<ChannelHeaderV2> channel_headers{};
+    // Where the blobs begin in the input
+    size_t blobs_offset{};
+    // Blobs are only read once a brick they belong to is requested. Until then, a header's pointer is null.
+    std::unique_ptr<std::atomic<uint8_t const *>[]> blob_ptrs{};
+    std::vector<std::unique_ptr<uint8_t[]>> blob_chunks{};
+#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
+    std::mutex blob_mtx{};
+#endif
+
+    // From level 0 up to a single node covering the whole grid
+    std::vector<UniformLevel> uniform_levels{};
 
     std::array<uint32_t, 32> channel_indices{};
 };
 
+static void build_uniform_levels(GvoxPaletteParseUserState &user_state) {
+    auto const channel_n = user_state.channel_n;
+    auto &levels = user_state.uniform_levels;
+    levels.clear();
+    auto &base = levels.emplace_back(UniformLevel{.nx = user_state.r_nx, .ny = user_state.r_ny, .nz = user_state.r_nz, .nodes = {}});
+    base.nodes.resize(user_state.channel_headers.size());
+    for (size_t header_i = 0; header_i < user_state.channel_headers.size(); ++header_i) {
+        auto const &channel_header = user_state.channel_headers[header_i];
+        // Bricks without any voxels (variant_n == 0) sample as 0 everywhere, so they're uniform too
+        base.nodes[header_i] = channel_header.variant_n <= 1
+                                   ? UniformNode{.value = static_cast<uint32_t>(channel_header.blob_offset), .is_uniform = 1}
+                                   : UniformNode{.value = 0, .is_uniform = 0};
+    }
+    while (levels.back().nx > 1 || levels.back().ny > 1 || levels.back().nz > 1) {
+        auto const &child = levels.back();
+        auto level = UniformLevel{.nx = (child.nx + 1) / 2, .ny = (child.ny + 1) / 2, .nz = (child.nz + 1) / 2, .nodes = {}};
+        level.nodes.resize(static_cast<size_t>(level.nx) * level.ny * level.nz * channel_n);
+        for (uint32_t zi = 0; zi < level.nz; ++zi) {
+            for (uint32_t yi = 0; yi < level.ny; ++yi) {
+                for (uint32_t xi = 0; xi < level.nx; ++xi) {
+                    for (uint32_t ci = 0; ci < channel_n; ++ci) {
+                        auto node = UniformNode{.value = 0, .is_uniform = 0};
+                        auto is_first = true;
+                        auto is_uniform = true;
+                        for (uint32_t cz = zi * 2; cz < std::min(zi * 2 + 2, child.nz) && is_uniform; ++cz) {
+                            for (uint32_t cy = yi * 2; cy < std::min(yi * 2 + 2, child.ny) && is_uniform; ++cy) {
+                                for (uint32_t cx = xi * 2; cx < std::min(xi * 2 + 2, child.nx) && is_uniform; ++cx) {
+                                    auto const &child_node = child.nodes[(cx + cy * child.nx + static_cast<size_t>(cz) * child.nx * child.ny) * channel_n + ci];
+                                    is_uniform = child_node.is_uniform != 0 && (is_first || child_node.value == node.value);
+                                    node.value = child_node.value;
+                                    is_first = false;
+                                }
+                            }
+                        }
+                        node.is_uniform = is_uniform ? 1 : 0;
+                        level.nodes[(xi + yi * level.nx + static_cast<size_t>(zi) * level.nx * level.ny) * channel_n + ci] = node;
+                    }
+                }
+            }
+        }
+        levels.push_back(std::move(level));
+    }
+}
+
+// Whether the bricks in [lo, hi) that are under the given node are all uniform with the same value as `value`.
+// The first uniform node found sets `value`, if `has_value` is false. Uniform nodes are answered right away, so
+// only the nodes along the edges of the range that aren't uniform as a whole get descended into.
+static auto is_uniform_below(
+    GvoxPaletteParseUserState const &user_state, size_t level_i, uint32_t xi, uint32_t yi, uint32_t zi, uint32_t channel_index,
+    std::array<uint32_t, 3> const &lo, std::array<uint32_t, 3> const &hi, uint32_t &value, bool &has_value) -> bool {
+    auto const &level = user_state.uniform_levels[level_i];
+    auto const &node = level.nodes[(xi + yi * level.nx + static_cast<size_t>(zi) * level.nx * level.ny) * user_state.channel_n + channel_index];
+    if (node.is_uniform != 0) {
+        if (!has_value) {
+            value = node.value;
+            has_value = true;
+        }
+        return node.value == value;
+    }
+    if (level_i == 0) {
+        return false;
+    }
+    auto const &child = user_state.uniform_levels[level_i - 1];
+    auto const child_shift = static_cast<uint32_t>(level_i - 1);
+    for (uint32_t cz = zi * 2; cz < std::min(zi * 2 + 2, child.nz); ++cz) {
+        for (uint32_t cy = yi * 2; cy < std::min(yi * 2 + 2, child.ny); ++cy) {
+            for (uint32_t cx = xi * 2; cx < std::min(xi * 2 + 2, child.nx); ++cx) {
+                // Children that don't overlap the range don't matter
+                if ((cx + 1) << child_shift <= lo[0] || cx << child_shift >= hi[0] ||
+                    (cy + 1) << child_shift <= lo[1] || cy << child_shift >= hi[1] ||
+                    (cz + 1) << child_shift <= lo[2] || cz << child_shift >= hi[2]) {
+                    continue;
+                }
+                if (!is_uniform_below(user_state, level_i - 1, cx, cy, cz, channel_index, lo, hi, value, has_value)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
 // Base
-extern "C" void gvox_parse_adapter_gvox_palette_create(GvoxAdapterContext *ctx, void const * /*unused*/) {
+extern "C" void gvox_parse_adapter_gvox_palette_create(GvoxAdapterContext *ctx, void const *config) {
     auto *user_state_ptr = malloc(sizeof(GvoxPaletteParseUserState));
-    [[maybe_unused]] auto &user_state = *(new (user_state_ptr) GvoxPaletteParseUserState());
+    auto &user_state = *(new (user_state_ptr) GvoxPaletteParseUserState());
     gvox_adapter_set_user_pointer(ctx, user_state_ptr);
+    if (config != nullptr) {
+        user_state.config = *static_cast<GvoxGvoxPaletteParseAdapterConfig const *>(config);
+    } else {
+        user_state.config = {
+            .decoded_brick_cache_size = 64,
+        };
+    }
 }
 
 extern "C" void gvox_parse_adapter_gvox_palette_destroy(GvoxAdapterContext *ctx) {
@@ -46,21 +177,29 @@ extern "C" void gvox_parse_adapter_gvox_palette_destroy(GvoxAdapterContext *ctx)
 
 extern "C" void gvox_parse_adapter_gvox_palette_blit_begin(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const * /*unused*/, uint32_t /*unused*/) {
     auto &user_state = *static_cast<GvoxPaletteParseUserState *>(gvox_adapter_get_user_pointer(ctx));
+    static auto next_cache_id = std::atomic_uint64_t{1};
+    user_state.cache_id = next_cache_id.fetch_add(1);
 
     uint32_t magic = 0;
     gvox_input_read(blit_ctx, user_state.offset, sizeof(uint32_t), &magic);
     user_state.offset += sizeof(uint32_t);
 
-    if (magic != std::bit_cast<uint32_t>(std::array<char, 4>{'g', 'v', 'p', '\0'})) {
+    if (magic != GVOX_PALETTE_MAGIC_V1 && magic != GVOX_PALETTE_MAGIC_V2 && magic != GVOX_PALETTE_MAGIC_V3) {
         gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_INVALID_INPUT, "parsing a gvox palette format must begin with a valid magic number");
         return;
     }
+    auto const is_v1 = magic == GVOX_PALETTE_MAGIC_V1;
+    auto const is_v3 = magic == GVOX_PALETTE_MAGIC_V3;
 
     gvox_input_read(blit_ctx, user_state.offset, sizeof(GvoxRegionRange), &user_state.range);
     user_state.offset += sizeof(GvoxRegionRange);
 
-    gvox_input_read(blit_ctx, user_state.offset, sizeof(uint32_t), &user_state.blob_size);
-    user_state.offset += sizeof(uint32_t);
+    if (is_v1) {
+        auto blob_size = uint32_t{};
+        gvox_input_read(blit_ctx, user_state.offset, sizeof(uint32_t), &blob_size);
+        user_state.offset += sizeof(uint32_t);
+        user_state.blob_size = blob_size;
+    }
 
     gvox_input_read(blit_ctx, user_state.offset, sizeof(uint32_t), &user_state.channel_flags);
     user_state.offset += sizeof(uint32_t);
@@ -68,6 +207,21 @@ extern "C" void gvox_parse_adapter_gvox_palette_blit_begin(GvoxBlitContext *blit
     gvox_input_read(blit_ctx, user_state.offset, sizeof(uint32_t), &user_state.channel_n);
     user_state.offset += sizeof(uint32_t);
 
+    user_state.region_size = static_cast<uint32_t>(DEFAULT_REGION_SIZE);
+    if (is_v3) {
+        gvox_input_read(blit_ctx, user_state.offset, sizeof(uint32_t), &user_state.region_size);
+        user_state.offset += sizeof(uint32_t);
+        if (!is_valid_region_size(user_state.region_size)) {
+            gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_INVALID_INPUT, "gvox palette bricks must be 8, 16 or 32 voxels wide");
+            return;
+        }
+    }
+
+    if (!is_v1) {
+        gvox_input_read(blit_ctx, user_state.offset, sizeof(uint64_t), &user_state.blob_size);
+        user_state.offset += sizeof(uint64_t);
+    }
+
     uint32_t next_channel = 0;
     for (uint8_t channel_i = 0; channel_i < 32; ++channel_i) {
         if ((user_state.channel_flags & (1u << channel_i)) != 0) {
@@ -76,30 +230,42 @@ extern "C" void gvox_parse_adapter_gvox_palette_blit_begin(GvoxBlitContext *blit
         }
     }
 
-    user_state.r_nx = (user_state.range.extent.x + REGION_SIZE - 1) / REGION_SIZE;
-    user_state.r_ny = (user_state.range.extent.y + REGION_SIZE - 1) / REGION_SIZE;
-    user_state.r_nz = (user_state.range.extent.z + REGION_SIZE - 1) / REGION_SIZE;
-
-    user_state.region_headers.resize(user_state.r_nx * user_state.r_ny * user_state.r_nz);
-    for (auto &region_header : user_state.region_headers) {
-        region_header.channels.resize(user_state.channel_n);
-        for (auto &channel_header : region_header.channels) {
-            gvox_input_read(blit_ctx, user_state.offset, sizeof(ChannelHeader), &channel_header);
-            user_state.offset += sizeof(ChannelHeader);
+    auto const region_size = user_state.region_size;
+    user_state.r_nx = (user_state.range.extent.x + region_size - 1) / region_size;
+    user_state.r_ny = (user_state.range.extent.y + region_size - 1) / region_size;
+    user_state.r_nz = (user_state.range.extent.z + region_size - 1) / region_size;
+
+    auto const header_n = static_cast<size_t>(user_state.r_nx) * user_state.r_ny * user_state.r_nz * user_state.channel_n;
+    user_state.channel_headers.resize(header_n);
+    if (is_v1) {
+        auto v1_headers = std::vector<ChannelHeader>(header_n);
+        gvox_input_read(blit_ctx, user_state.offset, header_n * sizeof(ChannelHeader), v1_headers.data());
+        user_state.offset += header_n * sizeof(ChannelHeader);
+        for (size_t header_i = 0; header_i < header_n; ++header_i) {
+            user_state.channel_headers[header_i] = {.variant_n = v1_headers[header_i].variant_n, .compressed_size = 0u, .blob_offset = v1_headers[header_i].blob_offset};
         }
+    } else {
+        gvox_input_read(blit_ctx, user_state.offset, header_n * sizeof(ChannelHeaderV2), user_state.channel_headers.data());
+        user_state.offset += header_n * sizeof(ChannelHeaderV2);
     }
 
-    user_state.buffer.resize(user_state.blob_size);
-    gvox_input_read(blit_ctx, user_state.offset, user_state.blob_size, user_state.buffer.data());
+    user_state.blobs_offset = user_state.offset;
+    user_state.blob_ptrs = std::make_unique<std::atomic<uint8_t const *>[]>(header_n);
+    build_uniform_levels(user_state);
 }
 
-extern "C" void gvox_parse_adapter_gvox_palette_blit_end(GvoxBlitContext * /*unused*/, GvoxAdapterContext * /*unused*/) {
+extern "C" void gvox_parse_adapter_gvox_palette_blit_end(GvoxBlitContext * /*unused*/, GvoxAdapterContext *ctx) {
+    auto &user_state = *static_cast<GvoxPaletteParseUserState *>(gvox_adapter_get_user_pointer(ctx));
+    user_state.blob_ptrs.reset();
+    user_state.blob_chunks.clear();
+    user_state.uniform_levels.clear();
 }
 
 // General
 extern "C" auto gvox_parse_adapter_gvox_palette_query_details() -> GvoxParseAdapterDetails {
     return {
         .preferred_blit_mode = GVOX_BLIT_MODE_DONT_CARE,
+        .supports_concurrent_sampling = 1,
     };
 }
 
@@ -108,7 +274,310 @@ extern "C" auto gvox_parse_adapter_gvox_palette_query_parsable_range(GvoxBlitCon
     return user_state.range;
 }
 
-extern "C" auto gvox_parse_adapter_gvox_palette_sample_region(GvoxBlitContext * /*unused*/, GvoxAdapterContext *ctx, GvoxRegion const * /*unused*/, GvoxOffset3D const *offset, uint32_t channel_id) -> GvoxSample {
+static auto get_channel_header(GvoxPaletteParseUserState const &user_state, uint32_t brick_index, uint32_t channel_index) -> ChannelHeaderV2 const & {
+    return user_state.channel_headers[static_cast<size_t>(brick_index) * user_state.channel_n + channel_index];
+}
+
+static auto get_blob_size(GvoxPaletteParseUserState const &user_state, ChannelHeaderV2 const &channel_header) -> size_t {
+    if (channel_header.variant_n <= 1) {
+        return 0;
+    }
+    if (channel_header.variant_n > get_max_region_compressed_variant_n(user_state.region_size)) {
+        return calc_max_region_allocation_size(user_state.region_size);
+    }
+    return calc_block_size(user_state.region_size, channel_header.variant_n);
+}
+
+static auto get_stored_blob_size(GvoxPaletteParseUserState const &user_state, ChannelHeaderV2 const &channel_header) -> size_t {
+    return channel_header.compressed_size != 0 ? channel_header.compressed_size : get_blob_size(user_state, channel_header);
+}
+
+// Blobs closer together than this are read in one go, since the bytes in between are cheaper than another read
+static constexpr auto BLOB_COALESCE_GAP = size_t{4096};
+
+// Reads the blobs of every brick intersecting `range` that hasn't been read yet, coalescing neighbouring blobs
+static void load_blobs(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxPaletteParseUserState &user_state, GvoxRegionRange const &range, uint32_t channel_flags) {
+    auto const &src_range = user_state.range;
+    auto const x0 = std::max(range.offset.x, src_range.offset.x);
+    auto const y0 = std::max(range.offset.y, src_range.offset.y);
+    auto const z0 = std::max(range.offset.z, src_range.offset.z);
+    auto const x1 = std::min(range.offset.x + static_cast<int32_t>(range.extent.x), src_range.offset.x + static_cast<int32_t>(src_range.extent.x));
+    auto const y1 = std::min(range.offset.y + static_cast<int32_t>(range.extent.y), src_range.offset.y + static_cast<int32_t>(src_range.extent.y));
+    auto const z1 = std::min(range.offset.z + static_cast<int32_t>(range.extent.z), src_range.offset.z + static_cast<int32_t>(src_range.extent.z));
+    channel_flags &= user_state.channel_flags;
+    if (x0 >= x1 || y0 >= y1 || z0 >= z1 || channel_flags == 0) {
+        return;
+    }
+    auto const region_size = user_state.region_size;
+    auto const ax = static_cast<uint32_t>(x0 - src_range.offset.x) / region_size;
+    auto const ay = static_cast<uint32_t>(y0 - src_range.offset.y) / region_size;
+    auto const az = static_cast<uint32_t>(z0 - src_range.offset.z) / region_size;
+    auto const bx = (static_cast<uint32_t>(x1 - src_range.offset.x) + region_size - 1) / region_size;
+    auto const by = (static_cast<uint32_t>(y1 - src_range.offset.y) + region_size - 1) / region_size;
+    auto const bz = (static_cast<uint32_t>(z1 - src_range.offset.z) + region_size - 1) / region_size;
+
+    // Compressed blobs are decompressed after the lock is released, so that threads loading different parts
+    // of the data decompress in parallel. Two threads may then both load a blob, in which case either copy will do.
+    auto compressed_blobs = std::vector<std::pair<size_t, uint8_t const *>>{};
+#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
+    auto lock = std::unique_lock{user_state.blob_mtx};
+#endif
+    auto header_indices = std::vector<size_t>{};
+    for (uint32_t zi = az; zi < bz; ++zi) {
+        for (uint32_t yi = ay; yi < by; ++yi) {
+            for (uint32_t xi = ax; xi < bx; ++xi) {
+                auto const brick_index = static_cast<size_t>(xi + yi * user_state.r_nx + zi * user_state.r_nx * user_state.r_ny);
+                for (uint32_t channel_id = 0; channel_id < 32; ++channel_id) {
+                    if (((channel_flags >> channel_id) & 0x1) == 0) {
+                        continue;
+                    }
+                    auto const header_i = brick_index * user_state.channel_n + user_state.channel_indices[channel_id];
+                    if (user_state.channel_headers[header_i].variant_n > 1 && user_state.blob_ptrs[header_i].load(std::memory_order_relaxed) == nullptr) {
+                        header_indices.push_back(header_i);
+                    }
+                }
+            }
+        }
+    }
+    std::sort(header_indices.begin(), header_indices.end(), [&](size_t a, size_t b) {
+        return user_state.channel_headers[a].blob_offset < user_state.channel_headers[b].blob_offset;
+    });
+    for (size_t span_begin_i = 0; span_begin_i < header_indices.size();) {
+        auto const span_begin = static_cast<size_t>(user_state.channel_headers[header_indices[span_begin_i]].blob_offset);
+        auto span_end = span_begin + get_stored_blob_size(user_state, user_state.channel_headers[header_indices[span_begin_i]]);
+        auto span_end_i = span_begin_i + 1;
+        for (; span_end_i < header_indices.size(); ++span_end_i) {
+            auto const &channel_header = user_state.channel_headers[header_indices[span_end_i]];
+            if (channel_header.blob_offset > span_end + BLOB_COALESCE_GAP) {
+                break;
+            }
+            span_end = std::max(span_end, static_cast<size_t>(channel_header.blob_offset) + get_stored_blob_size(user_state, channel_header));
+        }
+        auto chunk = std::make_unique<uint8_t[]>(span_end - span_begin);
+        gvox_input_read(blit_ctx, user_state.blobs_offset + span_begin, span_end - span_begin, chunk.get());
+        for (auto i = span_begin_i; i < span_end_i; ++i) {
+            auto const header_i = header_indices[i];
+            auto const *blob = chunk.get() + (user_state.channel_headers[header_i].blob_offset - span_begin);
+            if (user_state.channel_headers[header_i].compressed_size != 0) {
+                compressed_blobs.emplace_back(header_i, blob);
+            } else {
+                user_state.blob_ptrs[header_i].store(blob, std::memory_order_release);
+            }
+        }
+        user_state.blob_chunks.push_back(std::move(chunk));
+        span_begin_i = span_end_i;
+    }
+    if (compressed_blobs.empty()) {
+        return;
+    }
+#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
+    lock.unlock();
+#endif
+    auto decompressed_size = size_t{0};
+    for (auto const &[header_i, blob] : compressed_blobs) {
+        decompressed_size += get_blob_size(user_state, user_state.channel_headers[header_i]);
+    }
+    auto chunk = std::make_unique<uint8_t[]>(decompressed_size);
+    auto *decompressed = chunk.get();
+    for (auto const &[header_i, blob] : compressed_blobs) {
+        auto const &channel_header = user_state.channel_headers[header_i];
+        if (!gvox_detail::lz::decompress(blob, channel_header.compressed_size, decompressed, get_blob_size(user_state, channel_header))) {
+            gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_INVALID_INPUT, "a compressed brick in the gvox palette data is corrupt");
+            std::memset(decompressed, 0, get_blob_size(user_state, channel_header));
+        }
+        auto const *expected = static_cast<uint8_t const *>(nullptr);
+        user_state.blob_ptrs[header_i].compare_exchange_strong(expected, decompressed, std::memory_order_release, std::memory_order_relaxed);
+        decompressed += get_blob_size(user_state, channel_header);
+    }
+#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
+    lock.lock();
+#endif
+    user_state.blob_chunks.push_back(std::move(chunk));
+}
+
+// Returns null for uniform bricks, which have no blob
+static auto get_blob(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxPaletteParseUserState &user_state, uint32_t brick_index, uint32_t channel_index) -> uint8_t const * {
+    auto const header_i = static_cast<size_t>(brick_index) * user_state.channel_n + channel_index;
+    if (user_state.channel_headers[header_i].variant_n <= 1) {
+        return nullptr;
+    }
+    auto const *blob = user_state.blob_ptrs[header_i].load(std::memory_order_acquire);
+    if (blob != nullptr) {
+        return blob;
+    }
+    // Nothing asked for this brick up front (through load_region, say), so just its blob gets read
+    auto const xi = brick_index % user_state.r_nx;
+    auto const yi = (brick_index / user_state.r_nx) % user_state.r_ny;
+    auto const zi = brick_index / (user_state.r_nx * user_state.r_ny);
+    auto channel_id = uint32_t{0};
+    while (((user_state.channel_flags >> channel_id) & 0x1) == 0 || user_state.channel_indices[channel_id] != channel_index) {
+        ++channel_id;
+    }
+    auto const brick_range = GvoxRegionRange{
+        .offset = {
+            user_state.range.offset.x + static_cast<int32_t>(xi * user_state.region_size),
+            user_state.range.offset.y + static_cast<int32_t>(yi * user_state.region_size),
+            user_state.range.offset.z + static_cast<int32_t>(zi * user_state.region_size),
+        },
+        .extent = {1, 1, 1},
+    };
+    load_blobs(blit_ctx, ctx, user_state, brick_range, 1u << channel_id);
+    return user_state.blob_ptrs[header_i].load(std::memory_order_acquire);
+}
+
+// Blobs are word aligned in files gvox writes, but nothing stops other files from placing them anywhere
+static auto read_u32(uint8_t const *ptr) -> uint32_t {
+    auto result = uint32_t{};
+    std::memcpy(&result, ptr, sizeof(result));
+    return result;
+}
+
+template <size_t REGION_SIZE>
+static auto sample_channel_header(ChannelHeaderV2 const &channel_header, uint8_t const *blob, uint32_t index) -> uint32_t {
+    if (channel_header.variant_n <= 1) {
+        return static_cast<uint32_t>(channel_header.blob_offset);
+    }
+    uint8_t const *buffer_ptr = blob;
+    if (channel_header.variant_n > MAX_REGION_COMPRESSED_VARIANT_N<REGION_SIZE>) {
+        return read_u32(buffer_ptr + index * sizeof(uint32_t));
+    }
+    auto const *palette_begin = buffer_ptr;
+    auto const bits_per_variant = ceil_log2(channel_header.variant_n);
+    buffer_ptr += channel_header.variant_n * sizeof(uint32_t);
+    auto const bit_index = index * bits_per_variant;
+    auto const byte_index = bit_index / 8;
+    auto const bit_offset = static_cast<uint32_t>(bit_index - byte_index * 8);
+    auto const mask = get_mask(bits_per_variant);
+    // Note: Reading through a uint32_t pointer here would break the strict aliasing rules of C++.
+    auto input = std::bit_cast<uint32_t>(*reinterpret_cast<std::array<uint8_t, 4> const *>(buffer_ptr + byte_index));
+    auto const palette_id = (input >> bit_offset) & mask;
+    return read_u32(palette_begin + palette_id * sizeof(uint32_t));
+}
+
+template <size_t REGION_SIZE>
+using BrickVoxels = std::array<uint32_t, BRICK_VOXEL_N<REGION_SIZE>>;
+
+template <size_t REGION_SIZE, uint32_t BITS>
+static void decode_brick_indices(uint8_t const *packed, uint8_t const *palette, uint32_t *out) {
+    constexpr auto mask = get_mask(BITS);
+    constexpr auto voxel_n = static_cast<uint32_t>(BRICK_VOXEL_N<REGION_SIZE>);
+    uint32_t i = 0;
+#if defined(__AVX2__)
+    // 8 voxels at a time: gather the 4 bytes holding each index, shift and mask it out, then gather the palette.
+    // An index never straddles more than 4 bytes, and the packed data is padded so the last load stays in bounds.
+    static_assert(BITS + 7 <= 32);
+    auto const lane_bit_index = _mm256_setr_epi32(0 * BITS, 1 * BITS, 2 * BITS, 3 * BITS, 4 * BITS, 5 * BITS, 6 * BITS, 7 * BITS);
+    for (; i + 8 <= voxel_n; i += 8) {
+        auto const bit_index = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i * BITS)), lane_bit_index);
+        auto const byte_index = _mm256_srli_epi32(bit_index, 3);
+        auto const bit_offset = _mm256_and_si256(bit_index, _mm256_set1_epi32(7));
+        auto const words = _mm256_i32gather_epi32(reinterpret_cast<int const *>(packed), byte_index, 1);
+        auto const palette_ids = _mm256_and_si256(_mm256_srlv_epi32(words, bit_offset), _mm256_set1_epi32(static_cast<int>(mask)));
+        auto const values = _mm256_i32gather_epi32(reinterpret_cast<int const *>(palette), palette_ids, 4);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), values);
+    }
+#endif
+    for (; i < voxel_n; ++i) {
+        auto const bit_index = i * BITS;
+        auto word = uint32_t{};
+        std::memcpy(&word, packed + bit_index / 8, sizeof(word));
+        out[i] = read_u32(palette + ((word >> (bit_index % 8)) & mask) * sizeof(uint32_t));
+    }
+}
+
+// Decodes all of a brick's voxels at once, which is much cheaper per voxel than sample_channel_header
+template <size_t REGION_SIZE>
+static void decode_brick(ChannelHeaderV2 const &channel_header, uint8_t const *blob, uint32_t *out) {
+    if (channel_header.variant_n <= 1) {
+        std::fill_n(out, BRICK_VOXEL_N<REGION_SIZE>, static_cast<uint32_t>(channel_header.blob_offset));
+        return;
+    }
+    uint8_t const *buffer_ptr = blob;
+    if (channel_header.variant_n > MAX_REGION_COMPRESSED_VARIANT_N<REGION_SIZE>) {
+        std::memcpy(out, buffer_ptr, MAX_REGION_ALLOCATION_SIZE<REGION_SIZE>);
+        return;
+    }
+    using DecodeFn = void (*)(uint8_t const *, uint8_t const *, uint32_t *);
+    static constexpr auto decode_fns = []<uint32_t... I>(std::integer_sequence<uint32_t, I...>) {
+        return std::array<DecodeFn, sizeof...(I)>{&decode_brick_indices<REGION_SIZE, I + 1>...};
+    }(std::make_integer_sequence<uint32_t, MAX_BITS_PER_VARIANT<REGION_SIZE>>{});
+    decode_fns[ceil_log2(channel_header.variant_n) - 1](buffer_ptr + channel_header.variant_n * sizeof(uint32_t), buffer_ptr, out);
+}
+
+// Recently decoded bricks of whichever blit last sampled on this thread, evicting the least recently used
+struct DecodedBrickCache {
+    uint64_t owner_cache_id{};
+    uint64_t tick{};
+    size_t most_recent_i{};
+    std::vector<uint64_t> keys{};
+    std::vector<uint64_t> last_used{};
+    // The decoded voxels, one brick after the other
+    std::vector<uint32_t> bricks{};
+    size_t brick_voxel_n{};
+
+    // Returns null if the brick isn't cached
+    auto find(GvoxPaletteParseUserState const &user_state, uint32_t brick_index, uint32_t channel_index) -> uint32_t const * {
+        if (owner_cache_id != user_state.cache_id) {
+            owner_cache_id = user_state.cache_id;
+            keys.clear();
+            last_used.clear();
+            bricks.clear();
+            brick_voxel_n = static_cast<size_t>(user_state.region_size) * user_state.region_size * user_state.region_size;
+            // Never reallocated after this, so pointers to cached bricks stay valid until they're evicted
+            bricks.reserve(user_state.config.decoded_brick_cache_size * brick_voxel_n);
+        }
+        auto const key = (uint64_t{brick_index} << 32) | channel_index;
+        ++tick;
+        if (most_recent_i < keys.size() && keys[most_recent_i] == key) {
+            last_used[most_recent_i] = tick;
+            return bricks.data() + most_recent_i * brick_voxel_n;
+        }
+        auto const iter = std::find(keys.begin(), keys.end(), key);
+        if (iter != keys.end()) {
+            most_recent_i = static_cast<size_t>(iter - keys.begin());
+            last_used[most_recent_i] = tick;
+            return bricks.data() + most_recent_i * brick_voxel_n;
+        }
+        return nullptr;
+    }
+
+    template <size_t REGION_SIZE>
+    auto get(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxPaletteParseUserState &user_state, uint32_t brick_index, uint32_t channel_index) -> uint32_t const * {
+        if (auto const *result = find(user_state, brick_index, channel_index); result != nullptr) {
+            return result;
+        }
+        auto const key = (uint64_t{brick_index} << 32) | channel_index;
+        if (keys.size() < user_state.config.decoded_brick_cache_size) {
+            most_recent_i = keys.size();
+            keys.push_back(key);
+            last_used.push_back(tick);
+            bricks.resize(bricks.size() + brick_voxel_n);
+        } else {
+            most_recent_i = static_cast<size_t>(std::min_element(last_used.begin(), last_used.end()) - last_used.begin());
+            keys[most_recent_i] = key;
+            last_used[most_recent_i] = tick;
+        }
+        auto *brick = bricks.data() + most_recent_i * brick_voxel_n;
+        decode_brick<REGION_SIZE>(get_channel_header(user_state, brick_index, channel_index), get_blob(blit_ctx, ctx, user_state, brick_index, channel_index), brick);
+        return brick;
+    }
+};
+
+static thread_local DecodedBrickCache decoded_brick_cache{};
+
+template <size_t REGION_SIZE>
+static constexpr auto MIN_DECODED_RUN_LENGTH = static_cast<uint32_t>(REGION_SIZE * REGION_SIZE);
+
+template <size_t REGION_SIZE>
+static auto sample_brick(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxPaletteParseUserState &user_state, uint32_t brick_index, uint32_t channel_index, uint32_t index) -> uint32_t {
+    auto const &channel_header = get_channel_header(user_state, brick_index, channel_index);
+    if (channel_header.variant_n <= 1 || user_state.config.decoded_brick_cache_size == 0) {
+        return sample_channel_header<REGION_SIZE>(channel_header, get_blob(blit_ctx, ctx, user_state, brick_index, channel_index), index);
+    }
+    return decoded_brick_cache.get<REGION_SIZE>(blit_ctx, ctx, user_state, brick_index, channel_index)[index];
+}
+
+extern "C" auto gvox_parse_adapter_gvox_palette_sample_region(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion const * /*unused*/, GvoxOffset3D const *offset, uint32_t channel_id) -> GvoxSample {
     auto &user_state = *static_cast<GvoxPaletteParseUserState *>(gvox_adapter_get_user_pointer(ctx));
     if (offset->x < user_state.range.offset.x ||
         offset->y < user_state.range.offset.y ||
@@ -118,44 +587,19 @@ extern "C" auto gvox_parse_adapter_gvox_palette_sample_region(GvoxBlitContext *
         offset->z >= user_state.range.offset.z + static_cast<int32_t>(user_state.range.extent.z)) {
         return {0u, 0u};
     }
-    auto const xi = static_cast<uint32_t>(offset->x - user_state.range.offset.x) / REGION_SIZE;
-    auto const yi = static_cast<uint32_t>(offset->y - user_state.range.offset.y) / REGION_SIZE;
-    auto const zi = static_cast<uint32_t>(offset->z - user_state.range.offset.z) / REGION_SIZE;
-    auto const px = static_cast<uint32_t>(offset->x - user_state.range.offset.x) - xi * REGION_SIZE;
-    auto const py = static_cast<uint32_t>(offset->y - user_state.range.offset.y) - yi * REGION_SIZE;
-    auto const pz = static_cast<uint32_t>(offset->z - user_state.range.offset.z) - zi * REGION_SIZE;
-    auto r_nx = user_state.r_nx;
-    auto r_ny = user_state.r_ny;
-    auto &channel_header = user_state.region_headers[xi + yi * r_nx + zi * r_nx * r_ny].channels[user_state.channel_indices[channel_id]];
-    if (channel_header.variant_n <= 1) {
-        return {channel_header.blob_offset, 1u};
-    } else {
-        uint8_t *buffer_ptr = user_state.buffer.data() + channel_header.blob_offset;
-        if (channel_header.variant_n > MAX_REGION_COMPRESSED_VARIANT_N) {
-            auto const index = px + py * REGION_SIZE + pz * REGION_SIZE * REGION_SIZE;
-            // return 0;
-            return {*reinterpret_cast<uint32_t *>(buffer_ptr + index * sizeof(uint32_t)), 1u};
-        } else {
-            auto *palette_begin = reinterpret_cast<uint32_t *>(buffer_ptr);
-            auto const bits_per_variant = ceil_log2(channel_header.variant_n);
-            buffer_ptr += channel_header.variant_n * sizeof(uint32_t);
-            auto const index = px + py * REGION_SIZE + pz * REGION_SIZE * REGION_SIZE;
-            auto const bit_index = static_cast<uint32_t>(index) * bits_per_variant;
-            auto const byte_index = bit_index / 8;
-            auto const bit_offset = static_cast<uint32_t>(bit_index - byte_index * 8);
-            auto const mask = get_mask(bits_per_variant);
-#if 0
-            // Note: This is technically UB, since I think it breaks the strict aliasing rules of C++.
-            auto input = *reinterpret_cast<uint32_t *>(buffer_ptr + byte_index);
-            // The "correct" solution is below.
-#else
-            auto input = std::bit_cast<uint32_t>(*reinterpret_cast<std::array<uint8_t, 4> *>(buffer_ptr + byte_index));
-#endif
-            auto const palette_id = (input >> bit_offset) & mask;
-            // return palette_id;
-            return {palette_begin[palette_id], 1u};
-        }
-    }
+    return dispatch_region_size(user_state.region_size, [&](auto region_size) -> GvoxSample {
+        constexpr auto REGION_SIZE = static_cast<uint32_t>(region_size);
+        auto const xi = static_cast<uint32_t>(offset->x - user_state.range.offset.x) / REGION_SIZE;
+        auto const yi = static_cast<uint32_t>(offset->y - user_state.range.offset.y) / REGION_SIZE;
+        auto const zi = static_cast<uint32_t>(offset->z - user_state.range.offset.z) / REGION_SIZE;
+        auto const px = static_cast<uint32_t>(offset->x - user_state.range.offset.x) - xi * REGION_SIZE;
+        auto const py = static_cast<uint32_t>(offset->y - user_state.range.offset.y) - yi * REGION_SIZE;
+        auto const pz = static_cast<uint32_t>(offset->z - user_state.range.offset.z) - zi * REGION_SIZE;
+        auto r_nx = user_state.r_nx;
+        auto r_ny = user_state.r_ny;
+        auto const index = static_cast<uint32_t>(px + py * REGION_SIZE + pz * REGION_SIZE * REGION_SIZE);
+        return {sample_brick<region_size>(blit_ctx, ctx, user_state, static_cast<uint32_t>(xi + yi * r_nx + zi * r_nx * r_ny), user_state.channel_indices[channel_id], index), 1u};
+    });
 }
 
 // Serialize Driven
@@ -167,43 +611,50 @@ extern "C" auto gvox_parse_adapter_gvox_palette_query_region_flags(GvoxBlitConte
         return 0;
     }
 
-    auto ax = static_cast<uint32_t>(range->offset.x - user_state.range.offset.x) / static_cast<uint32_t>(REGION_SIZE);
-    auto ay = static_cast<uint32_t>(range->offset.y - user_state.range.offset.y) / static_cast<uint32_t>(REGION_SIZE);
-    auto az = static_cast<uint32_t>(range->offset.z - user_state.range.offset.z) / static_cast<uint32_t>(REGION_SIZE);
-    auto bx = (static_cast<uint32_t>(range->offset.x - user_state.range.offset.x) + range->extent.x + static_cast<uint32_t>(REGION_SIZE - 1)) / static_cast<uint32_t>(REGION_SIZE);
-    auto by = (static_cast<uint32_t>(range->offset.y - user_state.range.offset.y) + range->extent.y + static_cast<uint32_t>(REGION_SIZE - 1)) / static_cast<uint32_t>(REGION_SIZE);
-    auto bz = (static_cast<uint32_t>(range->offset.z - user_state.range.offset.z) + range->extent.z + static_cast<uint32_t>(REGION_SIZE - 1)) / static_cast<uint32_t>(REGION_SIZE);
+    // Voxels outside the data aren't present, so a range reaching past it is never uniform
+    if (range->offset.x < user_state.range.offset.x ||
+        range->offset.y < user_state.range.offset.y ||
+        range->offset.z < user_state.range.offset.z ||
+        range->offset.x + static_cast<int32_t>(range->extent.x) > user_state.range.offset.x + static_cast<int32_t>(user_state.range.extent.x) ||
+        range->offset.y + static_cast<int32_t>(range->extent.y) > user_state.range.offset.y + static_cast<int32_t>(user_state.range.extent.y) ||
+        range->offset.z + static_cast<int32_t>(range->extent.z) > user_state.range.offset.z + static_cast<int32_t>(user_state.range.extent.z) ||
+        range->extent.x == 0 || range->extent.y == 0 || range->extent.z == 0 || user_state.uniform_levels.empty()) {
+        return 0;
+    }
 
-    uint32_t flags = 0;
+    auto const region_size = user_state.region_size;
+    auto const lo = std::array<uint32_t, 3>{
+        static_cast<uint32_t>(range->offset.x - user_state.range.offset.x) / region_size,
+        static_cast<uint32_t>(range->offset.y - user_state.range.offset.y) / region_size,
+        static_cast<uint32_t>(range->offset.z - user_state.range.offset.z) / region_size,
+    };
+    auto const hi = std::array<uint32_t, 3>{
+        (static_cast<uint32_t>(range->offset.x - user_state.range.offset.x) + range->extent.x + (region_size - 1)) / region_size,
+        (static_cast<uint32_t>(range->offset.y - user_state.range.offset.y) + range->extent.y + (region_size - 1)) / region_size,
+        (static_cast<uint32_t>(range->offset.z - user_state.range.offset.z) + range->extent.z + (region_size - 1)) / region_size,
+    };
 
+    // Every requested channel has to be uniform, though each may have its own value
+    auto const top_level_i = user_state.uniform_levels.size() - 1;
     for (uint32_t channel_id = 0; channel_id < 32; ++channel_id) {
-        if (((1u << channel_id) & channel_flags) != 0) {
-            auto &a_channel_header = user_state.region_headers[ax + ay * user_state.r_nx + az * user_state.r_nx * user_state.r_ny].channels[user_state.channel_indices[channel_id]];
-            if (a_channel_header.variant_n == 1) {
-                flags |= GVOX_REGION_FLAG_UNIFORM;
-                for (uint32_t zi = az; zi < bz; ++zi) {
-                    for (uint32_t yi = ay; yi < by; ++yi) {
-                        for (uint32_t xi = ax; xi < bx; ++xi) {
-                            auto &b_channel_header = user_state.region_headers[xi + yi * user_state.r_nx + zi * user_state.r_nx * user_state.r_ny].channels[user_state.channel_indices[channel_id]];
-                            if (b_channel_header.variant_n != 1 || b_channel_header.blob_offset != a_channel_header.blob_offset) {
-                                flags = 0;
-                                break;
-                            }
-                        }
-                    }
-                }
-            }
+        if (((1u << channel_id) & channel_flags) == 0) {
+            continue;
+        }
+        auto value = uint32_t{};
+        auto has_value = false;
+        if (!is_uniform_below(user_state, top_level_i, 0, 0, 0, user_state.channel_indices[channel_id], lo, hi, value, has_value)) {
+            return 0;
         }
     }
-
-    return flags;
+    return channel_flags != 0 ? GVOX_REGION_FLAG_UNIFORM : 0u;
 }
 
-extern "C" auto gvox_parse_adapter_gvox_palette_load_region(GvoxBlitContext * /*unused*/, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t channel_flags) -> GvoxRegion {
+extern "C" auto gvox_parse_adapter_gvox_palette_load_region(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t channel_flags) -> GvoxRegion {
     auto &user_state = *static_cast<GvoxPaletteParseUserState *>(gvox_adapter_get_user_pointer(ctx));
     if ((channel_flags & ~user_state.channel_flags) != 0) {
         gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_REQUESTED_CHANNEL_NOT_PRESENT, "Tried loading a region with a channel that wasn't present in the original data");
     }
+    load_blobs(blit_ctx, ctx, user_state, *range, channel_flags);
     GvoxRegion const region = {
         .range = *range,
         .channels = channel_flags & user_state.channel_flags,
@@ -222,6 +673,7 @@ extern "C" void gvox_parse_adapter_gvox_palette_parse_region(GvoxBlitContext *bl
     if ((channel_flags & ~user_state.channel_flags) != 0) {
         gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_REQUESTED_CHANNEL_NOT_PRESENT, "Tried loading a region with a channel that wasn't present in the original data");
     }
+    load_blobs(blit_ctx, ctx, user_state, *range, channel_flags);
     GvoxRegion const region = {
         .range = *range,
         .channels = channel_flags & user_state.channel_flags,
@@ -230,3 +682,142 @@ extern "C" void gvox_parse_adapter_gvox_palette_parse_region(GvoxBlitContext *bl
     };
     gvox_emit_region(blit_ctx, &region);
 }
+
+// Optional
+template <size_t REGION_SIZE>
+static void sample_region_batch(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxPaletteParseUserState &user_state, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_id) {
+    auto const channel_index = user_state.channel_indices[channel_id];
+    auto const r_nx = user_state.r_nx;
+    auto const r_ny = user_state.r_ny;
+    auto const &range = user_state.range;
+    auto const use_cache = user_state.config.decoded_brick_cache_size != 0;
+    // Consecutive offsets almost always land in the same brick, so the brick lookup is cached
+    auto prev_brick_index = ~uint32_t{0};
+    auto run_n = uint32_t{0};
+    auto is_cachable = false;
+    ChannelHeaderV2 const *channel_header = nullptr;
+    uint8_t const *blob = nullptr;
+    uint32_t const *brick_voxels = nullptr;
+    for (uint32_t i = 0; i < sample_n; ++i) {
+        auto const rx = static_cast<uint32_t>(offsets[i].x - range.offset.x);
+        auto const ry = static_cast<uint32_t>(offsets[i].y - range.offset.y);
+        auto const rz = static_cast<uint32_t>(offsets[i].z - range.offset.z);
+        // negative relative offsets wrap around, so a single unsigned compare per axis suffices
+        if (rx >= range.extent.x || ry >= range.extent.y || rz >= range.extent.z) {
+            samples[i] = {0u, 0u};
+            continue;
+        }
+        auto const xi = rx / static_cast<uint32_t>(REGION_SIZE);
+        auto const yi = ry / static_cast<uint32_t>(REGION_SIZE);
+        auto const zi = rz / static_cast<uint32_t>(REGION_SIZE);
+        auto const brick_index = xi + yi * r_nx + zi * r_nx * r_ny;
+        if (brick_index != prev_brick_index) {
+            channel_header = &get_channel_header(user_state, brick_index, channel_index);
+            blob = get_blob(blit_ctx, ctx, user_state, brick_index, channel_index);
+            is_cachable = use_cache && channel_header->variant_n > 1;
+            brick_voxels = is_cachable ? decoded_brick_cache.find(user_state, brick_index, channel_index) : nullptr;
+            prev_brick_index = brick_index;
+            run_n = 0;
+        }
+        // A short run (say, one row crossing the brick) is cheaper to sample directly than to decode the brick
+        // for, so the brick is only decoded (evicting another) once enough consecutive samples have landed in it
+        if (brick_voxels == nullptr && is_cachable && ++run_n == MIN_DECODED_RUN_LENGTH<REGION_SIZE>) {
+            brick_voxels = decoded_brick_cache.get<REGION_SIZE>(blit_ctx, ctx, user_state, brick_index, channel_index);
+        }
+        auto const index = static_cast<uint32_t>((rx - xi * REGION_SIZE) + (ry - yi * REGION_SIZE) * REGION_SIZE + (rz - zi * REGION_SIZE) * REGION_SIZE * REGION_SIZE);
+        samples[i] = {brick_voxels != nullptr ? brick_voxels[index] : sample_channel_header<REGION_SIZE>(*channel_header, blob, index), 1u};
+    }
+}
+
+extern "C" void gvox_parse_adapter_gvox_palette_sample_region_batch(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion const * /*unused*/, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_id) {
+    auto &user_state = *static_cast<GvoxPaletteParseUserState *>(gvox_adapter_get_user_pointer(ctx));
+    dispatch_region_size(user_state.region_size, [&](auto region_size) {
+        sample_region_batch<region_size>(blit_ctx, ctx, user_state, offsets, samples, sample_n, channel_id);
+    });
+}
+
+template <size_t REGION_SIZE>
+static auto load_region_dense(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxPaletteParseUserState &user_state, GvoxRegionRange const *range, uint32_t channel_id, uint32_t *data, GvoxStrides3D const *strides) -> uint8_t {
+    auto const &src_range = user_state.range;
+    auto const x0 = std::max(range->offset.x, src_range.offset.x);
+    auto const y0 = std::max(range->offset.y, src_range.offset.y);
+    auto const z0 = std::max(range->offset.z, src_range.offset.z);
+    auto const x1 = std::min(range->offset.x + static_cast<int32_t>(range->extent.x), src_range.offset.x + static_cast<int32_t>(src_range.extent.x));
+    auto const y1 = std::min(range->offset.y + static_cast<int32_t>(range->extent.y), src_range.offset.y + static_cast<int32_t>(src_range.extent.y));
+    auto const z1 = std::min(range->offset.z + static_cast<int32_t>(range->extent.z), src_range.offset.z + static_cast<int32_t>(src_range.extent.z));
+    auto const is_channel_present = ((user_state.channel_flags >> channel_id) & 0x1) != 0;
+    auto const is_contained =
+        x0 == range->offset.x && y0 == range->offset.y && z0 == range->offset.z &&
+        x1 - x0 == static_cast<int32_t>(range->extent.x) &&
+        y1 - y0 == static_cast<int32_t>(range->extent.y) &&
+        z1 - z0 == static_cast<int32_t>(range->extent.z);
+    if (!is_channel_present) {
+        gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_REQUESTED_CHANNEL_NOT_PRESENT, "Tried loading a region with a channel that wasn't present in the original data");
+    }
+    if (!is_channel_present || !is_contained) {
+        for (uint32_t zi = 0; zi < range->extent.z; ++zi) {
+            for (uint32_t yi = 0; yi < range->extent.y; ++yi) {
+                for (uint32_t xi = 0; xi < range->extent.x; ++xi) {
+                    data[xi * strides->x + yi * strides->y + zi * strides->z] = 0u;
+                }
+            }
+        }
+        if (!is_channel_present || x0 >= x1 || y0 >= y1 || z0 >= z1) {
+            return 0u;
+        }
+    }
+    load_blobs(blit_ctx, ctx, user_state, *range, 1u << channel_id);
+    auto const channel_index = user_state.channel_indices[channel_id];
+    auto const r_nx = user_state.r_nx;
+    auto const r_ny = user_state.r_ny;
+    auto const brick_min = std::array<uint32_t, 3>{
+        static_cast<uint32_t>(x0 - src_range.offset.x) / static_cast<uint32_t>(REGION_SIZE),
+        static_cast<uint32_t>(y0 - src_range.offset.y) / static_cast<uint32_t>(REGION_SIZE),
+        static_cast<uint32_t>(z0 - src_range.offset.z) / static_cast<uint32_t>(REGION_SIZE),
+    };
+    auto const brick_max = std::array<uint32_t, 3>{
+        (static_cast<uint32_t>(x1 - src_range.offset.x) + static_cast<uint32_t>(REGION_SIZE) - 1) / static_cast<uint32_t>(REGION_SIZE),
+        (static_cast<uint32_t>(y1 - src_range.offset.y) + static_cast<uint32_t>(REGION_SIZE) - 1) / static_cast<uint32_t>(REGION_SIZE),
+        (static_cast<uint32_t>(z1 - src_range.offset.z) + static_cast<uint32_t>(REGION_SIZE) - 1) / static_cast<uint32_t>(REGION_SIZE),
+    };
+    auto brick_voxels = BrickScratch<REGION_SIZE, BrickVoxels<REGION_SIZE>>{};
+    for (uint32_t zi = brick_min[2]; zi < brick_max[2]; ++zi) {
+        for (uint32_t yi = brick_min[1]; yi < brick_max[1]; ++yi) {
+            for (uint32_t xi = brick_min[0]; xi < brick_max[0]; ++xi) {
+                auto const brick_index = xi + yi * r_nx + zi * r_nx * r_ny;
+                auto const &channel_header = get_channel_header(user_state, brick_index, channel_index);
+                auto const brick_x = src_range.offset.x + static_cast<int32_t>(xi * REGION_SIZE);
+                auto const brick_y = src_range.offset.y + static_cast<int32_t>(yi * REGION_SIZE);
+                auto const brick_z = src_range.offset.z + static_cast<int32_t>(zi * REGION_SIZE);
+                // The part of the brick that's inside the requested range
+                auto const bx0 = std::max(x0, brick_x);
+                auto const by0 = std::max(y0, brick_y);
+                auto const bz0 = std::max(z0, brick_z);
+                auto const bx1 = std::min(x1, brick_x + static_cast<int32_t>(REGION_SIZE));
+                auto const by1 = std::min(y1, brick_y + static_cast<int32_t>(REGION_SIZE));
+                auto const bz1 = std::min(z1, brick_z + static_cast<int32_t>(REGION_SIZE));
+                auto const is_uniform = channel_header.variant_n <= 1;
+                if (!is_uniform) {
+                    decode_brick<REGION_SIZE>(channel_header, get_blob(blit_ctx, ctx, user_state, brick_index, channel_index), brick_voxels->data());
+                }
+                for (int32_t z = bz0; z < bz1; ++z) {
+                    for (int32_t y = by0; y < by1; ++y) {
+                        auto *dst = data + static_cast<size_t>(y - range->offset.y) * strides->y + static_cast<size_t>(z - range->offset.z) * strides->z;
+                        auto const *src = brick_voxels->data() + static_cast<size_t>(y - brick_y) * REGION_SIZE + static_cast<size_t>(z - brick_z) * REGION_SIZE * REGION_SIZE;
+                        for (int32_t x = bx0; x < bx1; ++x) {
+                            dst[static_cast<size_t>(x - range->offset.x) * strides->x] = is_uniform ? static_cast<uint32_t>(channel_header.blob_offset) : src[x - brick_x];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return static_cast<uint8_t>(is_contained);
+}
+
+extern "C" auto gvox_parse_adapter_gvox_palette_load_region_dense(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t channel_id, uint32_t *data, GvoxStrides3D const *strides) -> uint8_t {
+    auto &user_state = *static_cast<GvoxPaletteParseUserState *>(gvox_adapter_get_user_pointer(ctx));
+    return dispatch_region_size(user_state.region_size, [&](auto region_size) {
+        return load_region_dense<region_size>(blit_ctx, ctx, user_state, range, channel_id, data, strides);
+    });
+}
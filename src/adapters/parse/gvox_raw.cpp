@@ -1,21 +1,69 @@
 #include <gvox/gvox.h>
 #include <gvox/adapters/parse/gvox_raw.h>
 
+#include "../shared/gvox_raw.hpp"
+
 #include <cstdlib>
 #include <cstring>
 
 #include <bit>
 #include <array>
 #include <vector>
+#include <algorithm>
 #include <new>
 
 struct GvoxRawParseUserState {
     GvoxRegionRange range{};
     uint32_t channel_flags{};
     uint32_t channel_n{};
+    uint32_t layout_flags{};
     size_t offset{};
+    // Channel k of the voxel at index i is element `i * voxel_stride + k * channel_stride` of the payload
+    size_t voxel_stride{};
+    size_t channel_stride{};
+    // `voxels` is null unless the input could be viewed in place
+    GvoxGvoxRawParseRegionData view{};
+};
+
+// A run of voxels along x, where channel k of the i-th voxel is at `data[i * voxel_stride + k * channel_stride]`
+struct VoxelRun {
+    uint32_t const *data;
+    size_t voxel_stride;
+    size_t channel_stride;
 };
 
+static auto is_in_range(GvoxRegionRange const &range, GvoxOffset3D const &offset) -> bool {
+    return offset.x >= range.offset.x && int64_t{offset.x} - range.offset.x < int64_t{range.extent.x} &&
+           offset.y >= range.offset.y && int64_t{offset.y} - range.offset.y < int64_t{range.extent.y} &&
+           offset.z >= range.offset.z && int64_t{offset.z} - range.offset.z < int64_t{range.extent.z};
+}
+
+// Only valid for offsets inside `range`
+static auto get_voxel_index(GvoxRegionRange const &range, GvoxOffset3D const &offset) -> size_t {
+    return static_cast<size_t>(offset.x - range.offset.x) + static_cast<size_t>(offset.y - range.offset.y) * range.extent.x + static_cast<size_t>(offset.z - range.offset.z) * range.extent.x * range.extent.y;
+}
+
+// Returns `voxel_n` voxels starting at `voxel_index`, straight out of the input if it's viewable, and read into
+// `buffer` otherwise. Planar files only read the planes whose bit is set in `voxel_channel_mask`.
+static auto read_voxels(GvoxBlitContext *blit_ctx, GvoxRawParseUserState const &user_state, size_t voxel_index, size_t voxel_n, uint32_t voxel_channel_mask, std::vector<uint32_t> &buffer) -> VoxelRun {
+    if (user_state.view.voxels != nullptr) {
+        return {user_state.view.voxels + voxel_index * user_state.voxel_stride, user_state.voxel_stride, user_state.channel_stride};
+    }
+    auto const channel_n = size_t{user_state.channel_n};
+    buffer.resize(voxel_n * channel_n);
+    if ((user_state.layout_flags & GVOX_RAW_LAYOUT_FLAG_PLANAR) == 0) {
+        gvox_input_read(blit_ctx, user_state.offset + sizeof(uint32_t) * voxel_index * channel_n, buffer.size() * sizeof(uint32_t), buffer.data());
+        return {buffer.data(), channel_n, 1};
+    }
+    for (size_t channel_i = 0; channel_i < channel_n; ++channel_i) {
+        if (((voxel_channel_mask >> channel_i) & 0x1) != 0) {
+            auto const read_offset = user_state.offset + sizeof(uint32_t) * (channel_i * user_state.channel_stride + voxel_index);
+            gvox_input_read(blit_ctx, read_offset, voxel_n * sizeof(uint32_t), buffer.data() + channel_i * voxel_n);
+        }
+    }
+    return {buffer.data(), 1, voxel_n};
+}
+
 // Base
 extern "C" void gvox_parse_adapter_gvox_raw_create(GvoxAdapterContext *ctx, void const * /*unused*/) {
     auto *user_state_ptr = malloc(sizeof(GvoxRawParseUserState));
@@ -31,12 +79,15 @@ extern "C" void gvox_parse_adapter_gvox_raw_destroy(GvoxAdapterContext *ctx) {
 
 extern "C" void gvox_parse_adapter_gvox_raw_blit_begin(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const * /*unused*/, uint32_t /*unused*/) {
     auto &user_state = *static_cast<GvoxRawParseUserState *>(gvox_adapter_get_user_pointer(ctx));
+    user_state.offset = 0;
+    user_state.layout_flags = 0;
+    user_state.view = {};
 
     uint32_t magic = 0;
     gvox_input_read(blit_ctx, user_state.offset, sizeof(uint32_t), &magic);
     user_state.offset += sizeof(uint32_t);
 
-    if (magic != std::bit_cast<uint32_t>(std::array<char, 4>{'g', 'v', 'r', '\0'})) {
+    if (magic != GVOX_RAW_MAGIC_V1 && magic != GVOX_RAW_MAGIC_V2) {
         gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_INVALID_INPUT, "parsing a gvox raw format must begin with a valid magic number");
         return;
     }
@@ -47,7 +98,38 @@ extern "C" void gvox_parse_adapter_gvox_raw_blit_begin(GvoxBlitContext *blit_ctx
     gvox_input_read(blit_ctx, user_state.offset, sizeof(uint32_t), &user_state.channel_flags);
     user_state.offset += sizeof(uint32_t);
 
+    if (magic == GVOX_RAW_MAGIC_V2) {
+        gvox_input_read(blit_ctx, user_state.offset, sizeof(uint32_t), &user_state.layout_flags);
+        user_state.offset += sizeof(uint32_t);
+        if ((user_state.layout_flags & ~GVOX_RAW_LAYOUT_FLAG_PLANAR) != 0) {
+            gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_INVALID_INPUT, "the gvox raw file uses a layout this version of gvox doesn't know");
+            return;
+        }
+    }
+
     user_state.channel_n = static_cast<uint32_t>(std::popcount(user_state.channel_flags));
+
+    auto const &range = user_state.range;
+    auto const channel_n = size_t{user_state.channel_n};
+    auto const voxel_n = size_t{range.extent.x} * range.extent.y * range.extent.z;
+    if ((user_state.layout_flags & GVOX_RAW_LAYOUT_FLAG_PLANAR) != 0) {
+        user_state.voxel_stride = 1;
+        user_state.channel_stride = voxel_n;
+    } else {
+        user_state.voxel_stride = channel_n;
+        user_state.channel_stride = 1;
+    }
+    user_state.view = {
+        .voxels = static_cast<uint32_t const *>(gvox_input_view(blit_ctx, user_state.offset, voxel_n * channel_n * sizeof(uint32_t))),
+        .range = range,
+        .channel_flags = user_state.channel_flags,
+        .strides = {
+            .x = user_state.voxel_stride,
+            .y = user_state.voxel_stride * range.extent.x,
+            .z = user_state.voxel_stride * range.extent.x * range.extent.y,
+        },
+        .channel_stride = user_state.channel_stride,
+    };
 }
 
 extern "C" void gvox_parse_adapter_gvox_raw_blit_end(GvoxBlitContext * /*unused*/, GvoxAdapterContext * /*unused*/) {
@@ -57,6 +139,7 @@ extern "C" void gvox_parse_adapter_gvox_raw_blit_end(GvoxBlitContext * /*unused*
 extern "C" auto gvox_parse_adapter_gvox_raw_query_details() -> GvoxParseAdapterDetails {
     return {
         .preferred_blit_mode = GVOX_BLIT_MODE_DONT_CARE,
+        .supports_concurrent_sampling = 1,
     };
 }
 
@@ -67,7 +150,9 @@ extern "C" auto gvox_parse_adapter_gvox_raw_query_parsable_range(GvoxBlitContext
 
 extern "C" auto gvox_parse_adapter_gvox_raw_sample_region(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion const * /*unused*/, GvoxOffset3D const *offset, uint32_t channel_id) -> GvoxSample {
     auto &user_state = *static_cast<GvoxRawParseUserState *>(gvox_adapter_get_user_pointer(ctx));
-    auto base_offset = user_state.offset;
+    if (!is_in_range(user_state.range, *offset)) {
+        return {0u, 0u};
+    }
     uint32_t voxel_data = 0;
     uint32_t voxel_channel_index = 0;
     for (uint32_t channel_index = 0; channel_index < channel_id; ++channel_index) {
@@ -75,8 +160,13 @@ extern "C" auto gvox_parse_adapter_gvox_raw_sample_region(GvoxBlitContext *blit_
             ++voxel_channel_index;
         }
     }
-    auto read_offset = base_offset + sizeof(uint32_t) * (voxel_channel_index + user_state.channel_n * (static_cast<size_t>(offset->x - user_state.range.offset.x) + static_cast<size_t>(offset->y - user_state.range.offset.y) * user_state.range.extent.x + static_cast<size_t>(offset->z - user_state.range.offset.z) * user_state.range.extent.x * user_state.range.extent.y));
-    gvox_input_read(blit_ctx, read_offset, sizeof(voxel_data), &voxel_data);
+    auto const voxel_index = get_voxel_index(user_state.range, *offset);
+    auto const element_index = voxel_channel_index * user_state.channel_stride + voxel_index * user_state.voxel_stride;
+    if (user_state.view.voxels != nullptr) {
+        voxel_data = user_state.view.voxels[element_index];
+    } else {
+        gvox_input_read(blit_ctx, user_state.offset + sizeof(uint32_t) * element_index, sizeof(voxel_data), &voxel_data);
+    }
     return {voxel_data, 1u};
 }
 
@@ -94,7 +184,7 @@ extern "C" auto gvox_parse_adapter_gvox_raw_load_region(GvoxBlitContext * /*unus
         .range = *range,
         .channels = channel_flags & user_state.channel_flags,
         .flags = 0u,
-        .data = nullptr,
+        .data = user_state.view.voxels != nullptr ? &user_state.view : nullptr,
     };
     return region;
 }
@@ -112,7 +202,144 @@ extern "C" void gvox_parse_adapter_gvox_raw_parse_region(GvoxBlitContext *blit_c
         .range = *range,
         .channels = channel_flags & user_state.channel_flags,
         .flags = 0u,
-        .data = nullptr,
+        .data = user_state.view.voxels != nullptr ? &user_state.view : nullptr,
     };
     gvox_emit_region(blit_ctx, &region);
 }
+
+// Optional
+extern "C" void gvox_parse_adapter_gvox_raw_sample_region_batch(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion const * /*unused*/, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_id) {
+    auto &user_state = *static_cast<GvoxRawParseUserState *>(gvox_adapter_get_user_pointer(ctx));
+    auto const voxel_channel_index = static_cast<uint32_t>(std::popcount(user_state.channel_flags & ((1u << channel_id) - 1u)));
+    auto const &range = user_state.range;
+    auto row_buffer = std::vector<uint32_t>{};
+    for (uint32_t i = 0; i < sample_n;) {
+        if (!is_in_range(range, offsets[i])) {
+            samples[i] = {0u, 0u};
+            ++i;
+            continue;
+        }
+        // Offsets that are consecutive along x are contiguous in the file, so they're read at once, up to the end
+        // of the row
+        auto const max_run_n = static_cast<uint32_t>(int64_t{range.offset.x} + range.extent.x - offsets[i].x);
+        uint32_t run_n = 1;
+        while (i + run_n < sample_n && run_n < max_run_n &&
+               offsets[i + run_n].x == offsets[i].x + static_cast<int32_t>(run_n) &&
+               offsets[i + run_n].y == offsets[i].y &&
+               offsets[i + run_n].z == offsets[i].z) {
+            ++run_n;
+        }
+        auto const voxel_index = get_voxel_index(range, offsets[i]);
+        auto const run = read_voxels(blit_ctx, user_state, voxel_index, run_n, 1u << voxel_channel_index, row_buffer);
+        auto const *channel_data = run.data + voxel_channel_index * run.channel_stride;
+        for (uint32_t run_i = 0; run_i < run_n; ++run_i) {
+            samples[i + run_i] = {channel_data[run_i * run.voxel_stride], 1u};
+        }
+        i += run_n;
+    }
+}
+
+extern "C" auto gvox_parse_adapter_gvox_raw_load_region_dense(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t channel_id, uint32_t *data, GvoxStrides3D const *strides) -> uint8_t {
+    auto &user_state = *static_cast<GvoxRawParseUserState *>(gvox_adapter_get_user_pointer(ctx));
+    auto const &src_range = user_state.range;
+    auto const x0 = std::max(range->offset.x, src_range.offset.x);
+    auto const y0 = std::max(range->offset.y, src_range.offset.y);
+    auto const z0 = std::max(range->offset.z, src_range.offset.z);
+    auto const x1 = std::min(range->offset.x + static_cast<int32_t>(range->extent.x), src_range.offset.x + static_cast<int32_t>(src_range.extent.x));
+    auto const y1 = std::min(range->offset.y + static_cast<int32_t>(range->extent.y), src_range.offset.y + static_cast<int32_t>(src_range.extent.y));
+    auto const z1 = std::min(range->offset.z + static_cast<int32_t>(range->extent.z), src_range.offset.z + static_cast<int32_t>(src_range.extent.z));
+    auto const is_channel_present = ((user_state.channel_flags >> channel_id) & 0x1) != 0;
+    auto const is_contained =
+        x0 == range->offset.x && y0 == range->offset.y && z0 == range->offset.z &&
+        x1 - x0 == static_cast<int32_t>(range->extent.x) &&
+        y1 - y0 == static_cast<int32_t>(range->extent.y) &&
+        z1 - z0 == static_cast<int32_t>(range->extent.z);
+    if (!is_channel_present) {
+        gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_REQUESTED_CHANNEL_NOT_PRESENT, "Tried loading a region with a channel that wasn't present in the original data");
+    }
+    if (!is_channel_present || !is_contained) {
+        for (uint32_t zi = 0; zi < range->extent.z; ++zi) {
+            for (uint32_t yi = 0; yi < range->extent.y; ++yi) {
+                for (uint32_t xi = 0; xi < range->extent.x; ++xi) {
+                    data[xi * strides->x + yi * strides->y + zi * strides->z] = 0u;
+                }
+            }
+        }
+        if (!is_channel_present || x0 >= x1 || y0 >= y1 || z0 >= z1) {
+            return 0u;
+        }
+    }
+    auto const voxel_channel_index = static_cast<size_t>(std::popcount(user_state.channel_flags & ((1u << channel_id) - 1u)));
+    auto const row_n = static_cast<size_t>(x1 - x0);
+    // Planar and single-channel files store each row of a channel contiguously
+    auto const is_row_contiguous = user_state.voxel_stride == 1 && strides->x == 1;
+    auto row_buffer = std::vector<uint32_t>{};
+    for (int32_t z = z0; z < z1; ++z) {
+        for (int32_t y = y0; y < y1; ++y) {
+            auto const voxel_index = static_cast<size_t>(x0 - src_range.offset.x) + static_cast<size_t>(y - src_range.offset.y) * src_range.extent.x + static_cast<size_t>(z - src_range.offset.z) * src_range.extent.x * src_range.extent.y;
+            auto *dst = data + static_cast<size_t>(x0 - range->offset.x) * strides->x + static_cast<size_t>(y - range->offset.y) * strides->y + static_cast<size_t>(z - range->offset.z) * strides->z;
+            if (is_row_contiguous && user_state.view.voxels == nullptr) {
+                auto const read_offset = user_state.offset + sizeof(uint32_t) * (voxel_channel_index * user_state.channel_stride + voxel_index);
+                gvox_input_read(blit_ctx, read_offset, row_n * sizeof(uint32_t), dst);
+                continue;
+            }
+            auto const run = read_voxels(blit_ctx, user_state, voxel_index, row_n, 1u << voxel_channel_index, row_buffer);
+            auto const *channel_data = run.data + voxel_channel_index * run.channel_stride;
+            if (is_row_contiguous) {
+                std::memcpy(dst, channel_data, row_n * sizeof(uint32_t));
+                continue;
+            }
+            for (size_t xi = 0; xi < row_n; ++xi) {
+                dst[xi * strides->x] = channel_data[xi * run.voxel_stride];
+            }
+        }
+    }
+    return static_cast<uint8_t>(is_contained);
+}
+
+extern "C" void gvox_parse_adapter_gvox_raw_sample_region_channels(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion const * /*unused*/, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_flags) {
+    auto &user_state = *static_cast<GvoxRawParseUserState *>(gvox_adapter_get_user_pointer(ctx));
+    if ((channel_flags & ~user_state.channel_flags) != 0) {
+        gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_REQUESTED_CHANNEL_NOT_PRESENT, "Tried sampling a channel that wasn't present in the original data");
+        channel_flags &= user_state.channel_flags;
+    }
+    auto voxel_channel_indices = std::array<uint32_t, 32>{};
+    uint32_t out_channel_n = 0;
+    uint32_t voxel_channel_mask = 0;
+    for (uint32_t channel_id = 0; channel_id < 32; ++channel_id) {
+        if (((channel_flags >> channel_id) & 0x1) != 0) {
+            voxel_channel_indices[out_channel_n] = static_cast<uint32_t>(std::popcount(user_state.channel_flags & ((1u << channel_id) - 1u)));
+            voxel_channel_mask |= 1u << voxel_channel_indices[out_channel_n];
+            ++out_channel_n;
+        }
+    }
+    auto const &range = user_state.range;
+    auto row_buffer = std::vector<uint32_t>{};
+    for (uint32_t i = 0; i < sample_n;) {
+        if (!is_in_range(range, offsets[i])) {
+            for (uint32_t channel_i = 0; channel_i < out_channel_n; ++channel_i) {
+                samples[i * out_channel_n + channel_i] = {0u, 0u};
+            }
+            ++i;
+            continue;
+        }
+        // Offsets that are consecutive along x are contiguous in the file (per channel, for planar files), up to
+        // the end of the row
+        auto const max_run_n = static_cast<uint32_t>(int64_t{range.offset.x} + range.extent.x - offsets[i].x);
+        uint32_t run_n = 1;
+        while (i + run_n < sample_n && run_n < max_run_n &&
+               offsets[i + run_n].x == offsets[i].x + static_cast<int32_t>(run_n) &&
+               offsets[i + run_n].y == offsets[i].y &&
+               offsets[i + run_n].z == offsets[i].z) {
+            ++run_n;
+        }
+        auto const voxel_index = get_voxel_index(range, offsets[i]);
+        auto const run = read_voxels(blit_ctx, user_state, voxel_index, run_n, voxel_channel_mask, row_buffer);
+        for (uint32_t run_i = 0; run_i < run_n; ++run_i) {
+            for (uint32_t channel_i = 0; channel_i < out_channel_n; ++channel_i) {
+                samples[(i + run_i) * out_channel_n + channel_i] = {run.data[run_i * run.voxel_stride + voxel_channel_indices[channel_i] * run.channel_stride], 1u};
+            }
+        }
+        i += run_n;
+    }
+}
@@ -18,9 +18,6 @@
 
 #include "../shared/thread_pool.hpp"
 using namespace gvox_detail::thread_pool;
-#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
-using namespace std::chrono_literals;
-#endif
 
 namespace magicavoxel {
     static constexpr uint32_t CHUNK_ID_VOX_ = std::bit_cast<uint32_t>(std::array{'V', 'O', 'X', ' '});
@@ -267,28 +264,31 @@ namespace magicavoxel {
         uint32_t index;
     };
 
+    // Nodes are stored depth-first, so an inner node's first child directly follows it, and `offset` is the index
+    // of its second child. A leaf instead covers the `count` instances starting at `offset`.
     struct BvhNode {
-        struct Children {
-            uint32_t offset;
-        };
-        struct Range {
-            uint32_t first;
-            uint32_t count;
-        };
         GvoxOffset3D aabb_min;
         GvoxOffset3D aabb_max;
-        std::variant<Children, Range> data;
+        uint32_t offset;
+        uint32_t count;
         [[nodiscard]] auto is_leaf() const -> bool {
-            return std::holds_alternative<Range>(data);
+            return count != 0;
         }
-        [[nodiscard]] auto needs_subdivide() const -> bool {
-            if (std::holds_alternative<Children>(data)) {
-                return true;
-            }
-            auto const &range = std::get<Range>(data);
-            return range.count > 2;
+        [[nodiscard]] auto contains(GvoxOffset3D const &p) const -> bool {
+            return p.x >= aabb_min.x && p.y >= aabb_min.y && p.z >= aabb_min.z &&
+                   p.x < aabb_max.x && p.y < aabb_max.y && p.z < aabb_max.z;
         }
     };
+    static_assert(sizeof(BvhNode) == 32);
+
+    // Bounds the traversal stack. Nodes this deep are made leaves, however many instances they hold
+    static constexpr uint32_t MAX_BVH_DEPTH = 64;
+    static constexpr uint32_t MAX_BVH_LEAF_SIZE = 4;
+    static constexpr uint32_t BVH_SAH_BIN_N = 16;
+    // Subtrees with at least this many instances build their second child on another thread
+    static constexpr uint32_t PARALLEL_BVH_BUILD_MIN_INSTANCES = 4096;
+    // Past this many overlapping leaves, dense loads walk the BVH for each voxel rather than testing every leaf
+    static constexpr uint32_t MAX_DENSE_LOAD_LEAF_N = 8;
 
     struct Scene {
         std::vector<Model> models{};
@@ -310,10 +310,11 @@ struct MagicavoxelParseUserState {
     std::array<uint8_t, 256> index_map{};
     bool found_index_map_chunk{};
     size_t offset{};
-    ThreadPool thread_pool{};
+    // Every channel's value for each palette id (255 being empty), so that sampling is a single lookup
+    std::array<std::array<uint32_t, 256>, 32> channel_values{};
 };
 
-void construct_scene(magicavoxel::Scene &scene, magicavoxel::SceneInfo &scene_info, uint32_t node_index, uint32_t depth, magicavoxel::Transform trn, GvoxOffset3D &min_p, GvoxOffset3D &max_p) {
+void construct_scene(magicavoxel::Scene &scene, magicavoxel::SceneInfo &scene_info, uint32_t node_index, uint32_t depth, magicavoxel::Transform trn) {
     auto const &node_info = scene_info.node_infos[node_index];
     if (std::holds_alternative<magicavoxel::SceneTransformInfo>(node_info)) {
         auto const &t_node_info = std::get<magicavoxel::SceneTransformInfo>(node_info);
@@ -323,7 +324,7 @@ void construct_scene(magicavoxel::Scene &scene, magicavoxel::SceneInfo &scene_in
         new_trn.offset.y += rotated_offset.y;
         new_trn.offset.z += rotated_offset.z;
         new_trn.rotation = magicavoxel::rotate(new_trn.rotation, t_node_info.transform.rotation);
-        construct_scene(scene, scene_info, t_node_info.child_node_id, depth + 1, new_trn, min_p, max_p);
+        construct_scene(scene, scene_info, t_node_info.child_node_id, depth + 1, new_trn);
     } else if (std::holds_alternative<magicavoxel::SceneGroupInfo>(node_info)) {
         auto const &g_node_info = std::get<magicavoxel::SceneGroupInfo>(node_info);
         scene.model_instances.reserve(scene.model_instances.size() + g_node_info.num_child_nodes);
@@ -331,7 +332,7 @@ void construct_scene(magicavoxel::Scene &scene, magicavoxel::SceneInfo &scene_in
             construct_scene(
                 scene, scene_info,
                 scene_info.group_children_ids[g_node_info.first_child_node_id_index + child_i],
-                depth + 1, trn, min_p, max_p);
+                depth + 1, trn);
         }
     } else if (std::holds_alternative<magicavoxel::SceneShapeInfo>(node_info)) {
         auto const &s_node_info = std::get<magicavoxel::SceneShapeInfo>(node_info);
@@ -363,170 +364,355 @@ void construct_scene(magicavoxel::Scene &scene, magicavoxel::SceneInfo &scene_in
             s_current_node.aabb_min.y + static_cast<int32_t>(extent.y),
             s_current_node.aabb_min.z + static_cast<int32_t>(extent.z),
         };
-        min_p.x = std::min(min_p.x, s_current_node.aabb_min.x);
-        min_p.y = std::min(min_p.y, s_current_node.aabb_min.y);
-        min_p.z = std::min(min_p.z, s_current_node.aabb_min.z);
-        max_p.x = std::max(max_p.x, s_current_node.aabb_max.x);
-        max_p.y = std::max(max_p.y, s_current_node.aabb_max.y);
-        max_p.z = std::max(max_p.z, s_current_node.aabb_max.z);
     }
 }
 
-void calc_bvh_node_range(std::vector<magicavoxel::ModelInstance> const &model_instances, magicavoxel::BvhNode &node) {
-    node.aabb_min = {
+struct BvhBounds {
+    GvoxOffset3D aabb_min{
         std::numeric_limits<int32_t>::max(),
         std::numeric_limits<int32_t>::max(),
         std::numeric_limits<int32_t>::max(),
     };
-    node.aabb_max = {
+    GvoxOffset3D aabb_max{
         std::numeric_limits<int32_t>::min(),
         std::numeric_limits<int32_t>::min(),
         std::numeric_limits<int32_t>::min(),
     };
-    if (auto *node_data = std::get_if<magicavoxel::BvhNode::Range>(&node.data)) {
-        for (uint32_t node_i = 0; node_i < node_data->count; node_i++) {
-            auto const &s_current_node = model_instances[node_data->first + node_i];
-            node.aabb_min.x = std::min(node.aabb_min.x, s_current_node.aabb_min.x);
-            node.aabb_min.y = std::min(node.aabb_min.y, s_current_node.aabb_min.y);
-            node.aabb_min.z = std::min(node.aabb_min.z, s_current_node.aabb_min.z);
-            node.aabb_max.x = std::max(node.aabb_max.x, s_current_node.aabb_max.x);
-            node.aabb_max.y = std::max(node.aabb_max.y, s_current_node.aabb_max.y);
-            node.aabb_max.z = std::max(node.aabb_max.z, s_current_node.aabb_max.z);
+    void grow(GvoxOffset3D const &other_min, GvoxOffset3D const &other_max) {
+        aabb_min.x = std::min(aabb_min.x, other_min.x);
+        aabb_min.y = std::min(aabb_min.y, other_min.y);
+        aabb_min.z = std::min(aabb_min.z, other_min.z);
+        aabb_max.x = std::max(aabb_max.x, other_max.x);
+        aabb_max.y = std::max(aabb_max.y, other_max.y);
+        aabb_max.z = std::max(aabb_max.z, other_max.z);
+    }
+    void grow(BvhBounds const &other) {
+        grow(other.aabb_min, other.aabb_max);
+    }
+    [[nodiscard]] auto volume() const -> double {
+        if (aabb_max.x < aabb_min.x) {
+            return 0.0;
         }
+        return static_cast<double>(int64_t{aabb_max.x} - aabb_min.x) *
+               static_cast<double>(int64_t{aabb_max.y} - aabb_min.y) *
+               static_cast<double>(int64_t{aabb_max.z} - aabb_min.z);
     }
+};
+
+// Twice the centre of the instance along `axis`, so that it stays an integer
+auto instance_centroid(magicavoxel::ModelInstance const &instance, uint32_t axis) -> int64_t {
+    auto const a_min = std::bit_cast<std::array<int32_t, 3>>(instance.aabb_min);
+    auto const a_max = std::bit_cast<std::array<int32_t, 3>>(instance.aabb_max);
+    return int64_t{a_min[axis]} + a_max[axis];
 }
 
-void subdivide_scene_bvh(std::vector<magicavoxel::ModelInstance> &model_instances, std::vector<magicavoxel::BvhNode> &bvh_nodes, magicavoxel::BvhNode &node) {
-    if (!node.needs_subdivide()) {
+// Appends the subtree over the `count` instances starting at `first` to `nodes`, reordering those instances so that
+// every leaf covers a contiguous run of them. Splits are chosen with a binned surface area heuristic, except that
+// samples are points rather than rays, so the chance of one visiting a node goes with its volume instead of its
+// surface area. Costs are relative to testing a single instance.
+void build_scene_bvh(magicavoxel::Scene &scene, ThreadPool &thread_pool, uint32_t first, uint32_t count, uint32_t depth, std::vector<magicavoxel::BvhNode> &nodes) {
+    auto &instances = scene.model_instances;
+    auto bounds = BvhBounds{};
+    auto centroid_min = std::array<int64_t, 3>{};
+    auto centroid_max = std::array<int64_t, 3>{};
+    centroid_min.fill(std::numeric_limits<int64_t>::max());
+    centroid_max.fill(std::numeric_limits<int64_t>::min());
+    for (uint32_t i = first; i < first + count; ++i) {
+        bounds.grow(instances[i].aabb_min, instances[i].aabb_max);
+        for (uint32_t axis = 0; axis < 3; ++axis) {
+            auto const centroid = instance_centroid(instances[i], axis);
+            centroid_min[axis] = std::min(centroid_min[axis], centroid);
+            centroid_max[axis] = std::max(centroid_max[axis], centroid);
+        }
+    }
+    auto const node_i = nodes.size();
+    nodes.push_back({
+        .aabb_min = bounds.aabb_min,
+        .aabb_max = bounds.aabb_max,
+        .offset = first,
+        .count = count,
+    });
+    if (count <= 2 || depth + 1 >= magicavoxel::MAX_BVH_DEPTH) {
         return;
     }
-    auto const &node_range = std::get<magicavoxel::BvhNode::Range>(node.data);
-    GvoxOffset3D const extent = {
-        node.aabb_max.x - node.aabb_min.x,
-        node.aabb_max.y - node.aabb_min.y,
-        node.aabb_max.z - node.aabb_min.z,
+
+    auto const bin_index = [&](magicavoxel::ModelInstance const &instance, uint32_t axis) -> uint32_t {
+        auto const extent = centroid_max[axis] - centroid_min[axis] + 1;
+        return static_cast<uint32_t>((instance_centroid(instance, axis) - centroid_min[axis]) * magicavoxel::BVH_SAH_BIN_N / extent);
     };
-    int32_t axis = 0;
-    int32_t split_p = 0;
-    if (extent.y > extent.x) {
-        if (extent.z > extent.y) {
-            axis = 2;
-        } else {
-            axis = 1;
+    auto best_cost = std::numeric_limits<double>::infinity();
+    auto best_axis = uint32_t{0};
+    auto best_bin = uint32_t{0};
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        if (centroid_min[axis] == centroid_max[axis]) {
+            continue;
         }
-    } else {
-        if (extent.z > extent.x) {
-            axis = 2;
-        } else {
-            axis = 0;
+        auto bin_bounds = std::array<BvhBounds, magicavoxel::BVH_SAH_BIN_N>{};
+        auto bin_counts = std::array<uint32_t, magicavoxel::BVH_SAH_BIN_N>{};
+        for (uint32_t i = first; i < first + count; ++i) {
+            auto const bin_i = bin_index(instances[i], axis);
+            bin_bounds[bin_i].grow(instances[i].aabb_min, instances[i].aabb_max);
+            ++bin_counts[bin_i];
+        }
+        // The cost of everything above each bin, so that a single sweep up from the bottom can price every split
+        auto upper_costs = std::array<double, magicavoxel::BVH_SAH_BIN_N>{};
+        auto upper_bounds = BvhBounds{};
+        auto upper_count = uint32_t{0};
+        for (uint32_t bin_i = magicavoxel::BVH_SAH_BIN_N - 1; bin_i > 0; --bin_i) {
+            upper_bounds.grow(bin_bounds[bin_i]);
+            upper_count += bin_counts[bin_i];
+            upper_costs[bin_i] = upper_count != 0 ? upper_bounds.volume() * upper_count : -1.0;
+        }
+        auto lower_bounds = BvhBounds{};
+        auto lower_count = uint32_t{0};
+        for (uint32_t bin_i = 0; bin_i < magicavoxel::BVH_SAH_BIN_N - 1; ++bin_i) {
+            lower_bounds.grow(bin_bounds[bin_i]);
+            lower_count += bin_counts[bin_i];
+            if (lower_count == 0 || upper_costs[bin_i + 1] < 0.0) {
+                continue;
+            }
+            auto const cost = lower_bounds.volume() * lower_count + upper_costs[bin_i + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = bin_i;
+            }
         }
     }
-    switch (axis) {
-    default:
-    case 0: split_p = node.aabb_min.x + extent.x / 2; break;
-    case 1: split_p = node.aabb_min.y + extent.y / 2; break;
-    case 2: split_p = node.aabb_min.z + extent.z / 2; break;
+    if (best_cost == std::numeric_limits<double>::infinity()) {
+        // Every centroid is in the same place, so there's nothing to split
+        return;
+    }
+    auto const node_volume = bounds.volume();
+    if (count <= magicavoxel::MAX_BVH_LEAF_SIZE && node_volume * count <= node_volume + best_cost) {
+        return;
     }
+
+    // Stable, so that overlapping instances keep their scene order within the leaves
     using IterDiff = std::vector<magicavoxel::ModelInstance>::difference_type;
-    auto first_iter = model_instances.begin() + static_cast<IterDiff>(node_range.first);
-    auto split_iter = std::partition(
+    auto first_iter = instances.begin() + static_cast<IterDiff>(first);
+    auto split_iter = std::stable_partition(
         first_iter,
-        first_iter + static_cast<IterDiff>(node_range.count),
-        [axis, split_p](auto const &i) -> bool {
-            switch (axis) {
-            default:
-            case 0: return std::midpoint(i.aabb_min.x, i.aabb_max.x) < split_p;
-            case 1: return std::midpoint(i.aabb_min.y, i.aabb_max.y) < split_p;
-            case 2: return std::midpoint(i.aabb_min.z, i.aabb_max.z) < split_p;
-            }
+        first_iter + static_cast<IterDiff>(count),
+        [&](magicavoxel::ModelInstance const &instance) -> bool {
+            return bin_index(instance, best_axis) <= best_bin;
         });
-    auto a_count = static_cast<uint32_t>(std::distance(first_iter, split_iter));
-    if (a_count == 0 || a_count == node_range.count) {
-        return;
+    auto const a_count = static_cast<uint32_t>(std::distance(first_iter, split_iter));
+    auto const b_first = first + a_count;
+    auto const b_count = count - a_count;
+
+    if (count >= magicavoxel::PARALLEL_BVH_BUILD_MIN_INSTANCES) {
+        auto b_nodes = std::vector<magicavoxel::BvhNode>{};
+        auto group = TaskGroup{thread_pool};
+        group.run([&scene, &thread_pool, &b_nodes, b_first, b_count, depth]() {
+            b_nodes.reserve(b_count * 2 - 1);
+            build_scene_bvh(scene, thread_pool, b_first, b_count, depth + 1, b_nodes);
+        });
+        build_scene_bvh(scene, thread_pool, first, a_count, depth + 1, nodes);
+        group.wait();
+        auto const b_offset = static_cast<uint32_t>(nodes.size());
+        for (auto node : b_nodes) {
+            if (!node.is_leaf()) {
+                node.offset += b_offset;
+            }
+            nodes.push_back(node);
+        }
+        nodes[node_i].offset = b_offset;
+    } else {
+        build_scene_bvh(scene, thread_pool, first, a_count, depth + 1, nodes);
+        nodes[node_i].offset = static_cast<uint32_t>(nodes.size());
+        build_scene_bvh(scene, thread_pool, b_first, b_count, depth + 1, nodes);
     }
-    auto insert_offset = bvh_nodes.size();
-    bvh_nodes.push_back({});
-    bvh_nodes.push_back({});
-    auto &node_a = bvh_nodes[insert_offset + 0];
-    auto &node_b = bvh_nodes[insert_offset + 1];
-    node_a.data = magicavoxel::BvhNode::Range{.first = node_range.first, .count = a_count};
-    node_b.data = magicavoxel::BvhNode::Range{.first = node_range.first + a_count, .count = node_range.count - a_count};
-    node.data = magicavoxel::BvhNode::Children{.offset = static_cast<uint32_t>(insert_offset)};
-    calc_bvh_node_range(model_instances, node_a);
-    calc_bvh_node_range(model_instances, node_b);
-    subdivide_scene_bvh(model_instances, bvh_nodes, node_a);
-    subdivide_scene_bvh(model_instances, bvh_nodes, node_b);
+    nodes[node_i].count = 0;
 }
 
-void construct_scene_bvh(magicavoxel::Scene &scene) {
-    scene.bvh_nodes.reserve(scene.model_instances.size() * 2 - 1);
-    uint32_t const root_node_i = 0;
-    auto &root = scene.bvh_nodes[root_node_i];
-    root.data = magicavoxel::BvhNode::Range{0, static_cast<uint32_t>(scene.model_instances.size())};
-    subdivide_scene_bvh(scene.model_instances, scene.bvh_nodes, root);
+void construct_scene_bvh(magicavoxel::Scene &scene, ThreadPool &thread_pool) {
+    scene.bvh_nodes.clear();
+    if (scene.model_instances.empty()) {
+        return;
+    }
+    auto const instance_n = static_cast<uint32_t>(scene.model_instances.size());
+    scene.bvh_nodes.reserve(instance_n * 2 - 1);
+    build_scene_bvh(scene, thread_pool, 0, instance_n, 0, scene.bvh_nodes);
 }
 
-void sample_scene_bvh(magicavoxel::Scene const &scene, magicavoxel::BvhNode const &node, GvoxOffset3D const &sample_pos, uint32_t &sampled_voxel) {
-    if (sample_pos.x < node.aabb_min.x ||
-        sample_pos.y < node.aabb_min.y ||
-        sample_pos.z < node.aabb_min.z ||
-        sample_pos.x >= node.aabb_max.x ||
-        sample_pos.y >= node.aabb_max.y ||
-        sample_pos.z >= node.aabb_max.z ||
-        sampled_voxel != 255) {
-        return;
+// Tests the instances of a leaf in order, stopping at the first one with a voxel at `sample_pos`
+void sample_bvh_leaf(magicavoxel::Scene const &scene, magicavoxel::BvhNode const &node, GvoxOffset3D const &sample_pos, uint32_t &sampled_voxel) {
+    for (uint32_t i = 0; i < node.count; ++i) {
+        auto const &s_current_node = scene.model_instances[node.offset + i];
+        auto const &model = scene.models[s_current_node.index];
+        if (sample_pos.x < s_current_node.aabb_min.x ||
+            sample_pos.y < s_current_node.aabb_min.y ||
+            sample_pos.z < s_current_node.aabb_min.z ||
+            sample_pos.x >= s_current_node.aabb_max.x ||
+            sample_pos.y >= s_current_node.aabb_max.y ||
+            sample_pos.z >= s_current_node.aabb_max.z) {
+            continue;
+        }
+        auto rel_p = GvoxExtent3D{
+            static_cast<uint32_t>(sample_pos.x - s_current_node.aabb_min.x),
+            static_cast<uint32_t>(sample_pos.y - s_current_node.aabb_min.y),
+            static_cast<uint32_t>(sample_pos.z - s_current_node.aabb_min.z),
+        };
+        rel_p = magicavoxel::rotate((s_current_node.rotation), rel_p, model.extent);
+        auto const index = rel_p.x + rel_p.y * model.extent.x + rel_p.z * model.extent.x * model.extent.y;
+
+        if (rel_p.x >= model.extent.x ||
+            rel_p.y >= model.extent.y ||
+            rel_p.z >= model.extent.z) {
+            continue;
+        }
+        if (index >= model.palette_ids.size()) {
+            continue;
+        }
+        sampled_voxel = model.palette_ids[index];
+        if (sampled_voxel != 255) {
+            break;
+        }
     }
-    if (node.is_leaf()) {
-        auto const &node_data = std::get<magicavoxel::BvhNode::Range>(node.data);
-        for (uint32_t i = 0; i < node_data.count; ++i) {
-            auto const &s_current_node = scene.model_instances[node_data.first + i];
-            auto const &model = scene.models[s_current_node.index];
-            if (sample_pos.x < s_current_node.aabb_min.x ||
-                sample_pos.y < s_current_node.aabb_min.y ||
-                sample_pos.z < s_current_node.aabb_min.z ||
-                sample_pos.x >= s_current_node.aabb_max.x ||
-                sample_pos.y >= s_current_node.aabb_max.y ||
-                sample_pos.z >= s_current_node.aabb_max.z) {
-                continue;
-            }
-            auto rel_p = GvoxExtent3D{
-                static_cast<uint32_t>(sample_pos.x - s_current_node.aabb_min.x),
-                static_cast<uint32_t>(sample_pos.y - s_current_node.aabb_min.y),
-                static_cast<uint32_t>(sample_pos.z - s_current_node.aabb_min.z),
-            };
-            rel_p = magicavoxel::rotate((s_current_node.rotation), rel_p, model.extent);
-            auto const index = rel_p.x + rel_p.y * model.extent.x + rel_p.z * model.extent.x * model.extent.y;
+}
 
-            if (rel_p.x >= model.extent.x ||
-                rel_p.y >= model.extent.y ||
-                rel_p.z >= model.extent.z) {
+// Walks the subtree rooted at `root_i` depth-first, first children before second ones, until a voxel is found, and
+// returns the index of the leaf it came from (or UINT32_MAX if there's none)
+auto sample_scene_bvh(magicavoxel::Scene const &scene, uint32_t root_i, GvoxOffset3D const &sample_pos, uint32_t &sampled_voxel) -> uint32_t {
+    auto const *nodes = scene.bvh_nodes.data();
+    // Deliberately left uninitialized, since this runs for every sampled voxel
+    std::array<uint32_t, magicavoxel::MAX_BVH_DEPTH> stack;
+    auto stack_n = uint32_t{0};
+    auto node_i = root_i;
+    while (true) {
+        auto const &node = nodes[node_i];
+        if (node.contains(sample_pos)) {
+            if (!node.is_leaf()) {
+                stack[stack_n++] = node.offset;
+                ++node_i;
                 continue;
             }
-            if (index >= model.palette_ids.size()) {
-                continue;
-            }
-            sampled_voxel = model.palette_ids[index];
+            sample_bvh_leaf(scene, node, sample_pos, sampled_voxel);
             if (sampled_voxel != 255) {
-                break;
+                return node_i;
             }
         }
-    } else {
-        auto const &node_data = std::get<magicavoxel::BvhNode::Children>(node.data);
-        auto const &node_a = scene.bvh_nodes[node_data.offset + 0];
-        auto const &node_b = scene.bvh_nodes[node_data.offset + 1];
-        sample_scene_bvh(scene, node_a, sample_pos, sampled_voxel);
-        if (sampled_voxel != 255) {
-            return;
+        if (stack_n == 0) {
+            return std::numeric_limits<uint32_t>::max();
         }
-        sample_scene_bvh(scene, node_b, sample_pos, sampled_voxel);
+        node_i = stack[--stack_n];
+    }
+}
+
+void sample_scene(magicavoxel::Scene const &scene, GvoxOffset3D const &sample_pos, uint32_t &sampled_voxel) {
+    if (scene.bvh_nodes.empty()) {
+        return;
+    }
+    sample_scene_bvh(scene, 0, sample_pos, sampled_voxel);
+}
+
+// Regions emitted by parse_region point at the leaf they cover
+auto region_bvh_node_index(magicavoxel::Scene const &scene, GvoxRegion const *region) -> uint32_t {
+    return static_cast<uint32_t>(static_cast<magicavoxel::BvhNode const *>(region->data) - scene.bvh_nodes.data());
+}
+
+// A region emitted by parse_region only holds the voxels of its leaf that sampling the whole scene returns as well.
+// Wherever leaves overlap, each voxel is then present in exactly one region, whatever order they're received in.
+void sample_region_leaf(magicavoxel::Scene const &scene, GvoxRegion const *region, GvoxOffset3D const &sample_pos, uint32_t &sampled_voxel) {
+    auto const leaf_i = region_bvh_node_index(scene, region);
+    sample_bvh_leaf(scene, scene.bvh_nodes[leaf_i], sample_pos, sampled_voxel);
+    if (sampled_voxel == 255) {
+        return;
+    }
+    auto scene_voxel = 255u;
+    if (sample_scene_bvh(scene, 0, sample_pos, scene_voxel) != leaf_i) {
+        sampled_voxel = 255;
     }
 }
 
-void sample_scene(magicavoxel::Scene &scene, GvoxOffset3D const &sample_pos, uint32_t &sampled_voxel) {
+// The leaves overlapping `range`, in the order a traversal would visit them
+void gather_bvh_leaves_in_range(magicavoxel::Scene const &scene, GvoxRegionRange const &range, std::vector<uint32_t> &leaves) {
     if (scene.bvh_nodes.empty()) {
         return;
     }
-    sample_scene_bvh(scene, scene.bvh_nodes[0], sample_pos, sampled_voxel);
+    auto const range_max = GvoxOffset3D{
+        range.offset.x + static_cast<int32_t>(range.extent.x),
+        range.offset.y + static_cast<int32_t>(range.extent.y),
+        range.offset.z + static_cast<int32_t>(range.extent.z),
+    };
+    auto stack = std::array<uint32_t, magicavoxel::MAX_BVH_DEPTH>{};
+    auto stack_n = uint32_t{0};
+    auto node_i = uint32_t{0};
+    while (true) {
+        auto const &node = scene.bvh_nodes[node_i];
+        if (node.aabb_min.x < range_max.x && range.offset.x < node.aabb_max.x &&
+            node.aabb_min.y < range_max.y && range.offset.y < node.aabb_max.y &&
+            node.aabb_min.z < range_max.z && range.offset.z < node.aabb_max.z) {
+            if (!node.is_leaf()) {
+                stack[stack_n++] = node.offset;
+                ++node_i;
+                continue;
+            }
+            leaves.push_back(node_i);
+        }
+        if (stack_n == 0) {
+            return;
+        }
+        node_i = stack[--stack_n];
+    }
+}
+
+static auto is_channel_supported(uint32_t channel_id) -> bool {
+    switch (channel_id) {
+    case GVOX_CHANNEL_ID_COLOR:
+    case GVOX_CHANNEL_ID_MATERIAL_ID:
+    case GVOX_CHANNEL_ID_ROUGHNESS:
+    case GVOX_CHANNEL_ID_METALNESS:
+    case GVOX_CHANNEL_ID_TRANSPARENCY:
+    case GVOX_CHANNEL_ID_IOR:
+    case GVOX_CHANNEL_ID_EMISSIVITY:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static auto sample_palette_channel(MagicavoxelParseUserState const &user_state, uint32_t palette_id, uint32_t channel_id) -> uint32_t {
+    switch (channel_id) {
+    case GVOX_CHANNEL_ID_COLOR:
+        if (palette_id < 255) {
+            auto const palette_val = user_state.palette[palette_id];
+            return std::bit_cast<uint32_t>(palette_val);
+        }
+        return 0;
+    case GVOX_CHANNEL_ID_MATERIAL_ID:
+        return static_cast<uint8_t>(palette_id + 1);
+    case GVOX_CHANNEL_ID_ROUGHNESS:
+        if (palette_id < 255 && ((user_state.materials[palette_id].content_flags & magicavoxel::MATERIAL_ROUGH_BIT) != 0u)) {
+            return std::bit_cast<uint32_t>(user_state.materials[palette_id].rough);
+        }
+        return 0;
+    case GVOX_CHANNEL_ID_METALNESS:
+        if (palette_id < 255 && ((user_state.materials[palette_id].content_flags & magicavoxel::MATERIAL_METAL_BIT) != 0u)) {
+            return std::bit_cast<uint32_t>(user_state.materials[palette_id].metal);
+        }
+        return 0;
+    case GVOX_CHANNEL_ID_TRANSPARENCY:
+        if (palette_id < 255 && ((user_state.materials[palette_id].content_flags & magicavoxel::MATERIAL_ALPHA_BIT) != 0u)) {
+            return std::bit_cast<uint32_t>(user_state.materials[palette_id].alpha);
+        }
+        return 0;
+    case GVOX_CHANNEL_ID_IOR:
+        if (palette_id < 255 && ((user_state.materials[palette_id].content_flags & magicavoxel::MATERIAL_IOR_BIT) != 0u)) {
+            return std::bit_cast<uint32_t>(user_state.materials[palette_id].ior);
+        }
+        return 0;
+    case GVOX_CHANNEL_ID_EMISSIVITY:
+        if (palette_id < 255) {
+            auto const palette_val = user_state.palette[palette_id];
+            auto is_emissive = (user_state.materials[palette_id].content_flags & magicavoxel::MATERIAL_EMIT_BIT) != 0;
+            return std::bit_cast<uint32_t>(palette_val) * static_cast<uint32_t>(is_emissive);
+        }
+        return 0;
+    default:
+        return 0;
+    }
 }
 
 // Base
@@ -902,20 +1088,13 @@ extern "C" void gvox_parse_adapter_magicavoxel_blit_begin(GvoxBlitContext *blit_
         }
     }
     if (!temp_scene_info.node_infos.empty()) {
-        user_state.scene.bvh_nodes.push_back({});
-        auto &root_node = user_state.scene.bvh_nodes[0];
-        root_node.aabb_min = {
-            std::numeric_limits<int32_t>::max(),
-            std::numeric_limits<int32_t>::max(),
-            std::numeric_limits<int32_t>::max(),
-        };
-        root_node.aabb_max = {
-            std::numeric_limits<int32_t>::min(),
-            std::numeric_limits<int32_t>::min(),
-            std::numeric_limits<int32_t>::min(),
-        };
-        construct_scene(user_state.scene, temp_scene_info, 0, 0, {}, root_node.aabb_min, root_node.aabb_max);
-        construct_scene_bvh(user_state.scene);
+        construct_scene(user_state.scene, temp_scene_info, 0, 0, {});
+        construct_scene_bvh(user_state.scene, get_thread_pool(ctx));
+    }
+    for (uint32_t channel_id = 0; channel_id < 32; ++channel_id) {
+        for (uint32_t palette_id = 0; palette_id < 256; ++palette_id) {
+            user_state.channel_values[channel_id][palette_id] = sample_palette_channel(user_state, palette_id, channel_id);
+        }
     }
 }
 
@@ -926,6 +1105,7 @@ extern "C" void gvox_parse_adapter_magicavoxel_blit_end(GvoxBlitContext * /*unus
 extern "C" auto gvox_parse_adapter_magicavoxel_query_details() -> GvoxParseAdapterDetails {
     return {
         .preferred_blit_mode = GVOX_BLIT_MODE_PARSE_DRIVEN,
+        .supports_concurrent_sampling = 1,
     };
 }
 
@@ -947,69 +1127,16 @@ extern "C" auto gvox_parse_adapter_magicavoxel_query_parsable_range(GvoxBlitCont
 
 extern "C" auto gvox_parse_adapter_magicavoxel_sample_region(GvoxBlitContext * /*unused*/, GvoxAdapterContext *ctx, GvoxRegion const *region, GvoxOffset3D const *offset, uint32_t channel_id) -> GvoxSample {
     auto &user_state = *static_cast<MagicavoxelParseUserState *>(gvox_adapter_get_user_pointer(ctx));
-    uint32_t voxel_data = 0;
     auto palette_id = 255u;
     if (region->data != nullptr) {
-        auto const &node = *reinterpret_cast<magicavoxel::BvhNode const *>(region->data);
-        sample_scene_bvh(user_state.scene, node, *offset, palette_id);
+        sample_region_leaf(user_state.scene, region, *offset, palette_id);
     } else {
         sample_scene(user_state.scene, *offset, palette_id);
     }
-    switch (channel_id) {
-    case GVOX_CHANNEL_ID_COLOR:
-        if (palette_id < 255) {
-            auto const palette_val = user_state.palette[palette_id];
-            voxel_data = std::bit_cast<uint32_t>(palette_val);
-        } else {
-            voxel_data = 0;
-        }
-        break;
-    case GVOX_CHANNEL_ID_MATERIAL_ID:
-        voxel_data = static_cast<uint8_t>(palette_id + 1);
-        break;
-    case GVOX_CHANNEL_ID_ROUGHNESS:
-        if (palette_id < 255 && ((user_state.materials[palette_id].content_flags & magicavoxel::MATERIAL_ROUGH_BIT) != 0u)) {
-            voxel_data = std::bit_cast<uint32_t>(user_state.materials[palette_id].rough);
-        } else {
-            voxel_data = 0;
-        }
-        break;
-    case GVOX_CHANNEL_ID_METALNESS:
-        if (palette_id < 255 && ((user_state.materials[palette_id].content_flags & magicavoxel::MATERIAL_METAL_BIT) != 0u)) {
-            voxel_data = std::bit_cast<uint32_t>(user_state.materials[palette_id].metal);
-        } else {
-            voxel_data = 0;
-        }
-        break;
-    case GVOX_CHANNEL_ID_TRANSPARENCY:
-        if (palette_id < 255 && ((user_state.materials[palette_id].content_flags & magicavoxel::MATERIAL_ALPHA_BIT) != 0u)) {
-            voxel_data = std::bit_cast<uint32_t>(user_state.materials[palette_id].alpha);
-        } else {
-            voxel_data = 0;
-        }
-        break;
-    case GVOX_CHANNEL_ID_IOR:
-        if (palette_id < 255 && ((user_state.materials[palette_id].content_flags & magicavoxel::MATERIAL_IOR_BIT) != 0u)) {
-            voxel_data = std::bit_cast<uint32_t>(user_state.materials[palette_id].ior);
-        } else {
-            voxel_data = 0;
-        }
-        break;
-    case GVOX_CHANNEL_ID_EMISSIVITY:
-        if (palette_id < 255) {
-            auto const palette_val = user_state.palette[palette_id];
-            auto is_emissive = (user_state.materials[palette_id].content_flags & magicavoxel::MATERIAL_EMIT_BIT) != 0;
-            voxel_data = std::bit_cast<uint32_t>(palette_val) * static_cast<uint32_t>(is_emissive);
-        } else {
-            voxel_data = 0;
-        }
-        break;
-    default:
+    if (!is_channel_supported(channel_id)) {
         gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_REQUESTED_CHANNEL_NOT_PRESENT, "Requested unsupported channel from magicavoxel file");
-        break;
     }
-
-    return {voxel_data, static_cast<uint8_t>(palette_id != 255u)};
+    return {user_state.channel_values[channel_id][palette_id], static_cast<uint8_t>(palette_id != 255u)};
 }
 
 // Serialize Driven
@@ -1037,35 +1164,55 @@ extern "C" auto gvox_parse_adapter_magicavoxel_load_region(GvoxBlitContext * /*u
 extern "C" void gvox_parse_adapter_magicavoxel_unload_region(GvoxBlitContext * /*unused*/, GvoxAdapterContext * /*unused*/, GvoxRegion * /*unused*/) {
 }
 
-void foreach_bvh_leaf(GvoxBlitContext *blit_ctx, MagicavoxelParseUserState &user_state, magicavoxel::Scene const &scene, magicavoxel::BvhNode const &node, uint32_t channel_flags) {
-    if (node.is_leaf()) {
-        user_state.thread_pool.enqueue([blit_ctx, &node, channel_flags]() {
-            GvoxRegion const region = {
-                .range = GvoxRegionRange{
-                    .offset = {
-                        node.aabb_min.x,
-                        node.aabb_min.y,
-                        node.aabb_min.z,
-                    },
-                    .extent = {
-                        static_cast<uint32_t>(node.aabb_max.x - node.aabb_min.x),
-                        static_cast<uint32_t>(node.aabb_max.y - node.aabb_min.y),
-                        static_cast<uint32_t>(node.aabb_max.z - node.aabb_min.z),
-                    },
-                },
-                .channels = channel_flags,
-                .flags = 0u,
-                .data = &node,
-            };
-            gvox_emit_region(blit_ctx, &region);
+// Since the nodes are stored depth-first, this is also the order a traversal visits the leaves in
+void gather_bvh_leaves(magicavoxel::Scene const &scene, std::vector<magicavoxel::BvhNode const *> &leaves) {
+    for (auto const &node : scene.bvh_nodes) {
+        if (node.is_leaf()) {
+            leaves.push_back(&node);
+        }
+    }
+}
+
+// Overlapping leaves never share a present voxel (see sample_region_leaf), but serializers may still touch the rest of
+// a region, so they aren't emitted at the same time. Each leaf goes into the wave after the last earlier leaf it
+// overlaps, and a wave's leaves are emitted concurrently.
+auto group_bvh_leaves_into_waves(std::vector<magicavoxel::BvhNode const *> const &leaves) -> std::vector<std::vector<magicavoxel::BvhNode const *>> {
+    auto const leaf_n = static_cast<uint32_t>(leaves.size());
+    auto sweep_order = std::vector<uint32_t>(leaf_n);
+    std::iota(sweep_order.begin(), sweep_order.end(), 0u);
+    std::sort(sweep_order.begin(), sweep_order.end(), [&](uint32_t a, uint32_t b) {
+        return leaves[a]->aabb_min.x < leaves[b]->aabb_min.x;
+    });
+    auto earlier_overlaps = std::vector<std::vector<uint32_t>>(leaf_n);
+    auto active = std::vector<uint32_t>{};
+    for (auto const leaf_i : sweep_order) {
+        auto const &leaf = *leaves[leaf_i];
+        std::erase_if(active, [&](uint32_t other_i) {
+            return leaves[other_i]->aabb_max.x <= leaf.aabb_min.x;
         });
-    } else {
-        auto const &node_data = std::get<magicavoxel::BvhNode::Children>(node.data);
-        auto const &node_a = scene.bvh_nodes[node_data.offset + 0];
-        auto const &node_b = scene.bvh_nodes[node_data.offset + 1];
-        foreach_bvh_leaf(blit_ctx, user_state, scene, node_a, channel_flags);
-        foreach_bvh_leaf(blit_ctx, user_state, scene, node_b, channel_flags);
+        for (auto const other_i : active) {
+            auto const &other = *leaves[other_i];
+            if (leaf.aabb_min.y < other.aabb_max.y && other.aabb_min.y < leaf.aabb_max.y &&
+                leaf.aabb_min.z < other.aabb_max.z && other.aabb_min.z < leaf.aabb_max.z) {
+                earlier_overlaps[std::max(leaf_i, other_i)].push_back(std::min(leaf_i, other_i));
+            }
+        }
+        active.push_back(leaf_i);
+    }
+    auto leaf_waves = std::vector<uint32_t>(leaf_n);
+    auto waves = std::vector<std::vector<magicavoxel::BvhNode const *>>{};
+    for (uint32_t leaf_i = 0; leaf_i < leaf_n; ++leaf_i) {
+        auto wave_i = uint32_t{0};
+        for (auto const other_i : earlier_overlaps[leaf_i]) {
+            wave_i = std::max(wave_i, leaf_waves[other_i] + 1);
+        }
+        leaf_waves[leaf_i] = wave_i;
+        if (waves.size() <= wave_i) {
+            waves.resize(wave_i + 1);
+        }
+        waves[wave_i].push_back(leaves[leaf_i]);
     }
+    return waves;
 }
 
 // Parse Driven
@@ -1078,12 +1225,126 @@ extern "C" void gvox_parse_adapter_magicavoxel_parse_region(GvoxBlitContext *bli
         gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_REQUESTED_CHANNEL_NOT_PRESENT, "Tried loading a region with a channel that wasn't present in the original data");
     }
     auto &user_state = *static_cast<MagicavoxelParseUserState *>(gvox_adapter_get_user_pointer(ctx));
-    user_state.thread_pool.start();
-    foreach_bvh_leaf(blit_ctx, user_state, user_state.scene, user_state.scene.bvh_nodes[0], channel_flags & available_channels);
-    while (user_state.thread_pool.busy()) {
-#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
-        std::this_thread::sleep_for(10ms);
-#endif
+    auto leaves = std::vector<magicavoxel::BvhNode const *>{};
+    gather_bvh_leaves(user_state.scene, leaves);
+    channel_flags &= available_channels;
+    auto &thread_pool = get_thread_pool(ctx);
+    auto const waves = group_bvh_leaves_into_waves(leaves);
+    for (auto const &wave : waves) {
+        parallel_for(thread_pool, 0, static_cast<uint32_t>(wave.size()), 1, [&](uint32_t leaf_begin, uint32_t leaf_end) {
+            for (uint32_t leaf_i = leaf_begin; leaf_i < leaf_end; ++leaf_i) {
+                auto const &node = *wave[leaf_i];
+                GvoxRegion const region = {
+                    .range = GvoxRegionRange{
+                        .offset = {
+                            node.aabb_min.x,
+                            node.aabb_min.y,
+                            node.aabb_min.z,
+                        },
+                        .extent = {
+                            static_cast<uint32_t>(node.aabb_max.x - node.aabb_min.x),
+                            static_cast<uint32_t>(node.aabb_max.y - node.aabb_min.y),
+                            static_cast<uint32_t>(node.aabb_max.z - node.aabb_min.z),
+                        },
+                    },
+                    .channels = channel_flags,
+                    .flags = 0u,
+                    .data = &node,
+                };
+                gvox_emit_region(blit_ctx, &region);
+            }
+        });
+    }
+}
+
+// Optional
+extern "C" void gvox_parse_adapter_magicavoxel_sample_region_batch(GvoxBlitContext * /*unused*/, GvoxAdapterContext *ctx, GvoxRegion const *region, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_id) {
+    auto &user_state = *static_cast<MagicavoxelParseUserState *>(gvox_adapter_get_user_pointer(ctx));
+    if (!is_channel_supported(channel_id)) {
+        gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_REQUESTED_CHANNEL_NOT_PRESENT, "Requested unsupported channel from magicavoxel file");
+    }
+    if (region->data == nullptr && user_state.scene.bvh_nodes.empty()) {
+        for (uint32_t i = 0; i < sample_n; ++i) {
+            samples[i] = {user_state.channel_values[channel_id][255], 0u};
+        }
+        return;
+    }
+    for (uint32_t i = 0; i < sample_n; ++i) {
+        auto palette_id = 255u;
+        if (region->data != nullptr) {
+            sample_region_leaf(user_state.scene, region, offsets[i], palette_id);
+        } else {
+            sample_scene(user_state.scene, offsets[i], palette_id);
+        }
+        samples[i] = {user_state.channel_values[channel_id][palette_id], static_cast<uint8_t>(palette_id != 255u)};
+    }
+}
+
+extern "C" auto gvox_parse_adapter_magicavoxel_load_region_dense(GvoxBlitContext * /*unused*/, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t channel_id, uint32_t *data, GvoxStrides3D const *strides) -> uint8_t {
+    auto &user_state = *static_cast<MagicavoxelParseUserState *>(gvox_adapter_get_user_pointer(ctx));
+    if (!is_channel_supported(channel_id)) {
+        gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_REQUESTED_CHANNEL_NOT_PRESENT, "Requested unsupported channel from magicavoxel file");
+    }
+    // Only the leaves overlapping the range can hold any of its voxels, so unless there are too many of them to be
+    // worth it, each voxel just tests those instead of walking the BVH from the root
+    auto leaves = std::vector<uint32_t>{};
+    gather_bvh_leaves_in_range(user_state.scene, *range, leaves);
+    auto const walk_bvh = leaves.size() > magicavoxel::MAX_DENSE_LOAD_LEAF_N;
+    auto all_present = true;
+    for (uint32_t zi = 0; zi < range->extent.z; ++zi) {
+        for (uint32_t yi = 0; yi < range->extent.y; ++yi) {
+            auto *dst = data + yi * strides->y + zi * strides->z;
+            for (uint32_t xi = 0; xi < range->extent.x; ++xi) {
+                auto const pos = GvoxOffset3D{
+                    range->offset.x + static_cast<int32_t>(xi),
+                    range->offset.y + static_cast<int32_t>(yi),
+                    range->offset.z + static_cast<int32_t>(zi),
+                };
+                auto palette_id = 255u;
+                if (walk_bvh) {
+                    sample_scene(user_state.scene, pos, palette_id);
+                } else {
+                    for (auto const leaf_i : leaves) {
+                        auto const &leaf = user_state.scene.bvh_nodes[leaf_i];
+                        if (leaf.contains(pos)) {
+                            sample_bvh_leaf(user_state.scene, leaf, pos, palette_id);
+                            if (palette_id != 255u) {
+                                break;
+                            }
+                        }
+                    }
+                }
+                all_present = all_present && (palette_id != 255u);
+                dst[xi * strides->x] = palette_id != 255u ? user_state.channel_values[channel_id][palette_id] : 0u;
+            }
+        }
+    }
+    return static_cast<uint8_t>(all_present);
+}
+
+extern "C" void gvox_parse_adapter_magicavoxel_sample_region_channels(GvoxBlitContext * /*unused*/, GvoxAdapterContext *ctx, GvoxRegion const *region, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_flags) {
+    auto &user_state = *static_cast<MagicavoxelParseUserState *>(gvox_adapter_get_user_pointer(ctx));
+    auto channel_ids = std::array<uint32_t, 32>{};
+    uint32_t channel_n = 0;
+    for (uint32_t channel_id = 0; channel_id < 32; ++channel_id) {
+        if (((channel_flags >> channel_id) & 0x1) != 0) {
+            if (!is_channel_supported(channel_id)) {
+                gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_REQUESTED_CHANNEL_NOT_PRESENT, "Requested unsupported channel from magicavoxel file");
+            }
+            channel_ids[channel_n++] = channel_id;
+        }
+    }
+    for (uint32_t i = 0; i < sample_n; ++i) {
+        // The BVH is only walked once, no matter how many channels are requested
+        auto palette_id = 255u;
+        if (region->data != nullptr) {
+            sample_region_leaf(user_state.scene, region, offsets[i], palette_id);
+        } else {
+            sample_scene(user_state.scene, offsets[i], palette_id);
+        }
+        auto const is_present = static_cast<uint8_t>(palette_id != 255u);
+        for (uint32_t channel_i = 0; channel_i < channel_n; ++channel_i) {
+            samples[i * channel_n + channel_i] = {user_state.channel_values[channel_ids[channel_i]][palette_id], is_present};
+        }
     }
-    user_state.thread_pool.stop();
 }
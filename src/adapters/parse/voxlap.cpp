@@ -9,6 +9,7 @@
 #include <array>
 #include <new>
 #include <limits>
+#include <algorithm>
 
 struct VoxlapParseUserState {
     GvoxVoxlapParseAdapterConfig config{};
@@ -165,6 +166,7 @@ extern "C" void gvox_parse_adapter_voxlap_blit_end(GvoxBlitContext * /*unused*/,
 extern "C" auto gvox_parse_adapter_voxlap_query_details() -> GvoxParseAdapterDetails {
     return {
         .preferred_blit_mode = GVOX_BLIT_MODE_DONT_CARE,
+        .supports_concurrent_sampling = 1,
     };
 }
 
@@ -229,3 +231,70 @@ extern "C" void gvox_parse_adapter_voxlap_parse_region(GvoxBlitContext *blit_ctx
     };
     gvox_emit_region(blit_ctx, &region);
 }
+
+// Optional
+extern "C" void gvox_parse_adapter_voxlap_sample_region_batch(GvoxBlitContext * /*unused*/, GvoxAdapterContext *ctx, GvoxRegion const * /*unused*/, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_id) {
+    auto &user_state = *static_cast<VoxlapParseUserState *>(gvox_adapter_get_user_pointer(ctx));
+    if (channel_id != GVOX_CHANNEL_ID_COLOR && channel_id != GVOX_CHANNEL_ID_MATERIAL_ID) {
+        std::fill(samples, samples + sample_n, GvoxSample{0u, 0u});
+        return;
+    }
+    auto const size_x = user_state.config.size_x;
+    auto const size_y = user_state.config.size_y;
+    auto const size_z = user_state.config.size_z;
+    for (uint32_t i = 0; i < sample_n; ++i) {
+        auto const &offset = offsets[i];
+        // negative offsets wrap around, so a single unsigned compare per axis suffices
+        if (static_cast<uint32_t>(offset.x) >= size_x ||
+            static_cast<uint32_t>(offset.y) >= size_y ||
+            static_cast<uint32_t>(offset.z) >= size_z) {
+            samples[i] = {0u, 0u};
+            continue;
+        }
+        auto const voxel_index =
+            static_cast<uint32_t>(offset.x) +
+            static_cast<uint32_t>(offset.y) * size_x +
+            static_cast<uint32_t>(offset.z) * size_x * size_y;
+        auto const is_solid = user_state.is_solid[voxel_index];
+        if (channel_id == GVOX_CHANNEL_ID_COLOR) {
+            samples[i] = {user_state.colors[voxel_index], static_cast<uint8_t>(is_solid)};
+        } else {
+            samples[i] = {static_cast<uint32_t>(is_solid), static_cast<uint8_t>(is_solid)};
+        }
+    }
+}
+
+extern "C" auto gvox_parse_adapter_voxlap_load_region_dense(GvoxBlitContext * /*unused*/, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t channel_id, uint32_t *data, GvoxStrides3D const *strides) -> uint8_t {
+    auto &user_state = *static_cast<VoxlapParseUserState *>(gvox_adapter_get_user_pointer(ctx));
+    auto const is_channel_present = channel_id == GVOX_CHANNEL_ID_COLOR || channel_id == GVOX_CHANNEL_ID_MATERIAL_ID;
+    auto const size_x = user_state.config.size_x;
+    auto const size_y = user_state.config.size_y;
+    auto const size_z = user_state.config.size_z;
+    auto all_present = is_channel_present;
+    for (uint32_t zi = 0; zi < range->extent.z; ++zi) {
+        auto const z = static_cast<uint32_t>(range->offset.z + static_cast<int32_t>(zi));
+        for (uint32_t yi = 0; yi < range->extent.y; ++yi) {
+            auto const y = static_cast<uint32_t>(range->offset.y + static_cast<int32_t>(yi));
+            auto *dst = data + yi * strides->y + zi * strides->z;
+            for (uint32_t xi = 0; xi < range->extent.x; ++xi) {
+                auto const x = static_cast<uint32_t>(range->offset.x + static_cast<int32_t>(xi));
+                if (!is_channel_present || x >= size_x || y >= size_y || z >= size_z) {
+                    dst[xi * strides->x] = 0u;
+                    all_present = false;
+                    continue;
+                }
+                auto const voxel_index = x + y * size_x + z * size_x * size_y;
+                auto const is_solid = user_state.is_solid[voxel_index];
+                all_present = all_present && is_solid;
+                if (!is_solid) {
+                    dst[xi * strides->x] = 0u;
+                } else if (channel_id == GVOX_CHANNEL_ID_COLOR) {
+                    dst[xi * strides->x] = user_state.colors[voxel_index];
+                } else {
+                    dst[xi * strides->x] = 1u;
+                }
+            }
+        }
+    }
+    return static_cast<uint8_t>(all_present);
+}
@@ -93,6 +93,14 @@ extern "C" void gvox_serialize_adapter_colored_text_blit_end(GvoxBlitContext *bl
     gvox_output_write(blit_ctx, 0, user_state.data.size(), user_state.data.data());
 }
 
+// General
+extern "C" auto gvox_serialize_adapter_colored_text_query_details() -> GvoxSerializeAdapterDetails {
+    // Downscaled pixels may straddle the ranges given to serialize_region
+    return {
+        .supports_concurrent_serialization = 0,
+    };
+}
+
 static void handle_region(ColoredTextSerializeUserState &user_state, GvoxRegionRange const *range, auto user_func) {
     for (uint32_t channel_i = 0; channel_i < user_state.channels.size(); ++channel_i) {
         auto channel_id = user_state.channels[channel_i];
@@ -215,17 +223,21 @@ static void handle_region(ColoredTextSerializeUserState &user_state, GvoxRegionR
 // Serialize Driven
 extern "C" void gvox_serialize_adapter_colored_text_serialize_region(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t /* channel_flags */) {
     auto &user_state = *static_cast<ColoredTextSerializeUserState *>(gvox_adapter_get_user_pointer(ctx));
+    auto const voxel_n = size_t{range->extent.x} * range->extent.y * range->extent.z;
+    auto voxels = std::vector<uint32_t>(voxel_n * user_state.channels.size());
+    auto channel_offsets = std::array<size_t, 32>{};
+    for (uint32_t channel_i = 0; channel_i < user_state.channels.size(); ++channel_i) {
+        channel_offsets[user_state.channels[channel_i]] = voxel_n * channel_i;
+        gvox_load_region_dense(blit_ctx, range, user_state.channels[channel_i], voxels.data() + voxel_n * channel_i, nullptr);
+    }
     handle_region(
         user_state, range,
-        [blit_ctx](uint32_t channel_id, GvoxOffset3D const &pos) {
-            auto const sample_range = GvoxRegionRange{
-                .offset = pos,
-                .extent = GvoxExtent3D{1, 1, 1},
-            };
-            auto region = gvox_load_region_range(blit_ctx, &sample_range, 1u << channel_id);
-            auto voxel = gvox_sample_region(blit_ctx, &region, &sample_range.offset, channel_id);
-            gvox_unload_region_range(blit_ctx, &region, &sample_range);
-            return voxel;
+        [range, &voxels, &channel_offsets](uint32_t channel_id, GvoxOffset3D const &pos) {
+            auto const index =
+                static_cast<size_t>(pos.x - range->offset.x) +
+                static_cast<size_t>(pos.y - range->offset.y) * range->extent.x +
+                static_cast<size_t>(pos.z - range->offset.z) * range->extent.x * range->extent.y;
+            return GvoxSample{voxels[channel_offsets[channel_id] + index], 1u};
         });
 }
 
@@ -2,28 +2,65 @@
 #include <gvox/adapters/serialize/gvox_palette.h>
 
 #include "../shared/gvox_palette.hpp"
+#include "../shared/lz.hpp"
 #include "../shared/thread_pool.hpp"
+using namespace gvox_detail::thread_pool;
 
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
 
 #include <bit>
 #include <array>
 #include <vector>
 #include <new>
-#include <unordered_set>
 #include <algorithm>
+#include <utility>
 #include <memory>
+#include <span>
 #include <mutex>
+#include <unordered_map>
+#include <atomic>
+#include <type_traits>
 
-using namespace gvox_detail::thread_pool;
+// Hands out runs of uint32_t carved from big slabs, so that staging a brick costs a pointer bump rather than a
+// heap allocation of its own. Nothing is freed until the arena is cleared.
+struct StagingArena {
+    static constexpr auto SLAB_SIZE = size_t{1} << 20;
+
+    std::vector<std::unique_ptr<uint32_t[]>> slabs{};
+    size_t slab_used{SLAB_SIZE};
+#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
+    std::mutex mtx{};
+#endif
+
+    auto allocate(size_t n) -> uint32_t * {
 #if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
-using namespace std::chrono_literals;
+        auto lock = std::lock_guard{mtx};
 #endif
+        if (slab_used + n > SLAB_SIZE) {
+            slabs.push_back(std::make_unique_for_overwrite<uint32_t[]>(SLAB_SIZE));
+            slab_used = 0;
+        }
+        auto *result = slabs.back().get() + slab_used;
+        slab_used += n;
+        return result;
+    }
+
+    void clear() {
+        slabs.clear();
+        slab_used = SLAB_SIZE;
+    }
+};
 
 struct PaletteRegion {
-    std::unordered_set<uint32_t> palette{};
-    std::unique_ptr<std::array<std::pair<uint32_t, bool>, REGION_SIZE * REGION_SIZE * REGION_SIZE>> data{};
+    // One value per voxel, with missing voxels left at 0. Null until something is written to the brick.
+    uint32_t *values{};
+    // One bit per voxel, set once the voxel has been written. Allocated along with `values`.
+    uint32_t *present{};
+    // Built from `values` in blit_end, sorted. Only kept for bricks that are palette compressed.
+    uint32_t *palette{};
+    uint32_t variant_n{};
     uint32_t accounted_for{};
 };
 
@@ -33,33 +70,154 @@ using PaletteRegionChannelsMutexes = std::vector<std::mutex>;
 #endif
 
 struct GvoxPaletteSerializeUserState {
+    GvoxGvoxPaletteSerializeAdapterConfig config{};
     GvoxRegionRange range{};
+    // Where the header table starts in the output
     size_t offset{};
     size_t blobs_begin{};
     size_t blob_size_offset{};
-    std::vector<uint8_t> data{};
+    // How many blob bytes have been written so far
+    size_t blob_size{};
     std::vector<uint8_t> channels{};
+    uint32_t channel_flags{};
     uint32_t region_nx{};
     uint32_t region_ny{};
     uint32_t region_nz{};
     std::vector<PaletteRegionChannels> palette_region_channels{};
+    // When streaming, each z slab of bricks gets its own arena, so that it can be released once the slab is written
+    std::unique_ptr<StagingArena[]> arenas{};
 #if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
     std::unique_ptr<PaletteRegionChannelsMutexes> palette_region_channels_mutexes{};
 #endif
-    ThreadPool thread_pool{};
+
+    // Streaming state: how many bricks of each z slab have been handled, and how many slabs have been written
+    std::unique_ptr<std::atomic_uint32_t[]> slab_handled_brick_ns{};
+    std::atomic_uint32_t written_slab_n{};
+#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
+    std::mutex write_mtx{};
+#endif
+
+    auto get_arena(uint32_t brick_index) -> StagingArena & {
+        return config.streaming != 0 ? arenas[brick_index / (region_nx * region_ny)] : arenas[0];
+    }
 };
 
+// Open addressing table for the distinct values of one brick, numbered in the order they were first inserted.
+// A brick can't have more than REGION_SIZE^3 + 1 of them (the extra one being the 0 that missing voxels are
+// filled with), so a fixed table that's never more than half full will do. It's meant to be reused from one brick
+// to the next, since clearing it only touches the slots that were used.
+template <size_t REGION_SIZE>
+struct BrickValueTable {
+    static constexpr auto MAX_SIZE = static_cast<uint32_t>(REGION_SIZE * REGION_SIZE * REGION_SIZE + 1);
+    static constexpr auto CAPACITY = std::bit_ceil(MAX_SIZE * 2);
+    static constexpr auto INDEX_BITS = static_cast<uint32_t>(std::countr_zero(CAPACITY));
+
+    std::array<uint32_t, CAPACITY> slots;
+    std::array<uint16_t, CAPACITY> slot_indices;
+    std::array<uint64_t, CAPACITY / 64> occupied{};
+    std::array<uint32_t, MAX_SIZE> values;
+    std::array<uint32_t, MAX_SIZE> value_slots;
+    uint32_t size{};
+
+    void clear() {
+        for (uint32_t i = 0; i < size; ++i) {
+            occupied[value_slots[i] / 64] &= ~(uint64_t{1} << (value_slots[i] % 64));
+        }
+        size = 0;
+    }
+
+    auto insert(uint32_t value) -> uint32_t {
+        // Fibonacci hashing, so that runs of nearby values don't all land in neighbouring slots
+        auto slot_i = (value * 0x9e3779b9u) >> (32 - INDEX_BITS);
+        while ((occupied[slot_i / 64] & (uint64_t{1} << (slot_i % 64))) != 0) {
+            if (slots[slot_i] == value) {
+                return slot_indices[slot_i];
+            }
+            slot_i = (slot_i + 1) & (CAPACITY - 1);
+        }
+        occupied[slot_i / 64] |= uint64_t{1} << (slot_i % 64);
+        slots[slot_i] = value;
+        slot_indices[slot_i] = static_cast<uint16_t>(size);
+        values[size] = value;
+        value_slots[size] = slot_i;
+        return size++;
+    }
+};
+
+template <size_t REGION_SIZE>
+using BrickIndices = std::array<uint16_t, REGION_SIZE * REGION_SIZE * REGION_SIZE>;
+
+// Everything finalizing and encoding a brick needs, allocated once per chunk of bricks rather than once per brick
+template <size_t REGION_SIZE>
+struct BrickEncodeScratch {
+    BrickValueTable<REGION_SIZE> values;
+    BrickIndices<REGION_SIZE> indices;
+};
+
+// Packs every index LSB first into a little bitstream, a whole 32-bit word at a time. The brick's bit count is
+// always a multiple of 32, so there's never a partial word left over.
+template <size_t REGION_SIZE, uint32_t BITS>
+static void pack_brick_indices(BrickIndices<REGION_SIZE> const &indices, uint8_t *output) {
+    static_assert((REGION_SIZE * REGION_SIZE * REGION_SIZE * BITS) % 32 == 0);
+    auto bit_buffer = uint64_t{0};
+    auto bit_buffer_n = uint32_t{0};
+    for (auto const index : indices) {
+        bit_buffer |= uint64_t{index} << bit_buffer_n;
+        bit_buffer_n += BITS;
+        if (bit_buffer_n >= 32) {
+            auto const word = static_cast<uint32_t>(bit_buffer);
+            std::memcpy(output, &word, sizeof(word));
+            output += sizeof(word);
+            bit_buffer >>= 32;
+            bit_buffer_n -= 32;
+        }
+    }
+}
+
+template <size_t REGION_SIZE>
+static void pack_brick_indices(BrickIndices<REGION_SIZE> const &indices, uint32_t bits_per_variant, uint8_t *output) {
+    using PackFn = void (*)(BrickIndices<REGION_SIZE> const &, uint8_t *);
+    static constexpr auto pack_fns = []<uint32_t... I>(std::integer_sequence<uint32_t, I...>) {
+        return std::array<PackFn, sizeof...(I)>{&pack_brick_indices<REGION_SIZE, I + 1>...};
+    }(std::make_integer_sequence<uint32_t, MAX_BITS_PER_VARIANT<REGION_SIZE>>{});
+    pack_fns[bits_per_variant - 1](indices, output);
+}
+
 template <typename T>
 static void write_data(uint8_t *&buffer_ptr, T const &data) {
-    *reinterpret_cast<T *>(buffer_ptr) = data;
+    std::memcpy(buffer_ptr, &data, sizeof(T));
     buffer_ptr += sizeof(T);
 }
 
 // Base
-extern "C" void gvox_serialize_adapter_gvox_palette_create(GvoxAdapterContext *ctx, void const * /*unused*/) {
+extern "C" void gvox_serialize_adapter_gvox_palette_create(GvoxAdapterContext *ctx, void const *config) {
     auto *user_state_ptr = malloc(sizeof(GvoxPaletteSerializeUserState));
-    [[maybe_unused]] auto &user_state = *(new (user_state_ptr) GvoxPaletteSerializeUserState());
+    auto &user_state = *(new (user_state_ptr) GvoxPaletteSerializeUserState());
     gvox_adapter_set_user_pointer(ctx, user_state_ptr);
+    if (config != nullptr) {
+        user_state.config = *static_cast<GvoxGvoxPaletteSerializeAdapterConfig const *>(config);
+    } else {
+        user_state.config = {
+            .version = 1,
+            .compression = GVOX_GVOX_PALETTE_SERIALIZE_ADAPTER_COMPRESSION_NONE,
+            .streaming = 0,
+            .brick_size = DEFAULT_REGION_SIZE,
+        };
+    }
+    // Configs written before brick sizes were selectable leave this zeroed
+    if (user_state.config.brick_size == 0) {
+        user_state.config.brick_size = DEFAULT_REGION_SIZE;
+    }
+    if (user_state.config.version < 1 || user_state.config.version > 3) {
+        gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_SERIALIZE_ADAPTER_UNREPRESENTABLE_DATA, "gvox_palette can only write versions 1 to 3 of the format");
+    } else if (user_state.config.version == 1 && user_state.config.compression != GVOX_GVOX_PALETTE_SERIALIZE_ADAPTER_COMPRESSION_NONE) {
+        gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_SERIALIZE_ADAPTER_UNREPRESENTABLE_DATA, "version 1 of gvox_palette doesn't support compression");
+    } else if (!is_valid_region_size(user_state.config.brick_size)) {
+        gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_SERIALIZE_ADAPTER_UNREPRESENTABLE_DATA, "gvox_palette bricks must be 8, 16 or 32 voxels wide");
+        user_state.config.brick_size = DEFAULT_REGION_SIZE;
+    } else if (user_state.config.version != 3 && user_state.config.brick_size != DEFAULT_REGION_SIZE) {
+        gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_SERIALIZE_ADAPTER_UNREPRESENTABLE_DATA, "only version 3 of gvox_palette supports brick sizes other than 8");
+    }
 }
 
 extern "C" void gvox_serialize_adapter_gvox_palette_destroy(GvoxAdapterContext *ctx) {
@@ -70,18 +228,32 @@ extern "C" void gvox_serialize_adapter_gvox_palette_destroy(GvoxAdapterContext *
 
 extern "C" void gvox_serialize_adapter_gvox_palette_blit_begin(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t channel_flags) {
     auto &user_state = *static_cast<GvoxPaletteSerializeUserState *>(gvox_adapter_get_user_pointer(ctx));
-    auto magic = std::bit_cast<uint32_t>(std::array<char, 4>{'g', 'v', 'p', '\0'});
+    auto const is_v1 = user_state.config.version == 1;
+    // Version 3 only differs from version 2 by storing the brick size, so files with the default size are written as
+    // version 2, which more versions of gvox can read
+    auto const is_v3 = user_state.config.version == 3 && user_state.config.brick_size != DEFAULT_REGION_SIZE;
+    auto magic = is_v1 ? GVOX_PALETTE_MAGIC_V1 : (is_v3 ? GVOX_PALETTE_MAGIC_V3 : GVOX_PALETTE_MAGIC_V2);
     auto channel_n = static_cast<uint32_t>(std::popcount(channel_flags));
     gvox_output_write(blit_ctx, user_state.offset, sizeof(uint32_t), &magic);
     user_state.offset += sizeof(magic);
     gvox_output_write(blit_ctx, user_state.offset, sizeof(*range), range);
     user_state.offset += sizeof(*range);
-    user_state.blob_size_offset = user_state.offset;
-    user_state.offset += sizeof(uint32_t);
+    if (is_v1) {
+        user_state.blob_size_offset = user_state.offset;
+        user_state.offset += sizeof(uint32_t);
+    }
     gvox_output_write(blit_ctx, user_state.offset, sizeof(channel_flags), &channel_flags);
     user_state.offset += sizeof(channel_flags);
     gvox_output_write(blit_ctx, user_state.offset, sizeof(channel_n), &channel_n);
     user_state.offset += sizeof(channel_n);
+    if (is_v3) {
+        gvox_output_write(blit_ctx, user_state.offset, sizeof(user_state.config.brick_size), &user_state.config.brick_size);
+        user_state.offset += sizeof(user_state.config.brick_size);
+    }
+    if (!is_v1) {
+        user_state.blob_size_offset = user_state.offset;
+        user_state.offset += sizeof(uint64_t);
+    }
     user_state.channels.resize(static_cast<size_t>(channel_n));
     uint32_t next_channel = 0;
     for (uint8_t channel_i = 0; channel_i < 32; ++channel_i) {
@@ -90,218 +262,470 @@ extern "C" void gvox_serialize_adapter_gvox_palette_blit_begin(GvoxBlitContext *
             ++next_channel;
         }
     }
+    user_state.channel_flags = channel_flags;
     user_state.range = *range;
-    user_state.region_nx = (range->extent.x + REGION_SIZE - 1) / REGION_SIZE;
-    user_state.region_ny = (range->extent.y + REGION_SIZE - 1) / REGION_SIZE;
-    user_state.region_nz = (range->extent.z + REGION_SIZE - 1) / REGION_SIZE;
-    auto size = (sizeof(ChannelHeader) * user_state.channels.size()) * user_state.region_nx * user_state.region_ny * user_state.region_nz;
+    auto const region_size = user_state.config.brick_size;
+    user_state.region_nx = (range->extent.x + region_size - 1) / region_size;
+    user_state.region_ny = (range->extent.y + region_size - 1) / region_size;
+    user_state.region_nz = (range->extent.z + region_size - 1) / region_size;
+    auto size = ((is_v1 ? sizeof(ChannelHeader) : sizeof(ChannelHeaderV2)) * user_state.channels.size()) * user_state.region_nx * user_state.region_ny * user_state.region_nz;
     user_state.blobs_begin = size;
+    user_state.blob_size = 0;
     user_state.palette_region_channels.resize(user_state.region_nx * user_state.region_ny * user_state.region_nz);
+    user_state.arenas = std::make_unique<StagingArena[]>(user_state.config.streaming != 0 ? user_state.region_nz : 1);
 #if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
     user_state.palette_region_channels_mutexes = std::make_unique<PaletteRegionChannelsMutexes>(user_state.region_nx * user_state.region_ny * user_state.region_nz * user_state.channels.size());
 #endif
-    user_state.data.resize(size);
+    if (user_state.config.streaming != 0) {
+        user_state.slab_handled_brick_ns = std::make_unique<std::atomic_uint32_t[]>(user_state.region_nz);
+        user_state.written_slab_n = 0;
+    }
 }
 
-extern "C" void gvox_serialize_adapter_gvox_palette_blit_end(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx) {
-    auto &user_state = *static_cast<GvoxPaletteSerializeUserState *>(gvox_adapter_get_user_pointer(ctx));
-    auto const two_percent_raw_size = static_cast<size_t>(user_state.range.extent.x * user_state.range.extent.y * user_state.range.extent.z) * sizeof(uint32_t) * user_state.channels.size() / 50;
-    user_state.data.reserve(user_state.offset + two_percent_raw_size);
-#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
-    std::mutex data_mutex;
-#endif
-    user_state.thread_pool.start();
-    for (uint32_t rzi = 0; rzi < user_state.region_nz; ++rzi) {
-        for (uint32_t ryi = 0; ryi < user_state.region_ny; ++ryi) {
-            for (uint32_t rxi = 0; rxi < user_state.region_nx; ++rxi) {
-                auto &palette_region_channel = user_state.palette_region_channels[rxi + ryi * user_state.region_nx + rzi * user_state.region_nx * user_state.region_ny];
-                for (uint32_t ci = 0; ci < user_state.channels.size(); ++ci) {
-                    auto region_header = ChannelHeader{.variant_n = 1u};
-                    auto size = size_t{0};
-                    auto local_data = std::vector<uint8_t>{};
-                    auto alloc_region = [&]() {
-                        {
-#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
-                            auto lock = std::lock_guard{data_mutex};
-#endif
-                            auto const old_size = user_state.data.size();
-                            region_header.blob_offset = static_cast<uint32_t>(old_size - user_state.blobs_begin);
-                            user_state.data.resize(old_size + size);
-                        }
-                        local_data.resize(size);
-                    };
-                    if (palette_region_channel.size() == user_state.channels.size()) {
-                        auto &palette_region = palette_region_channel.at(ci);
-                        if (palette_region.accounted_for != 0 && palette_region.accounted_for != REGION_SIZE * REGION_SIZE * REGION_SIZE) {
-                            palette_region.palette.insert(0u);
-                            for (uint32_t zi = 0; zi < REGION_SIZE; ++zi) {
-                                for (uint32_t yi = 0; yi < REGION_SIZE; ++yi) {
-                                    for (uint32_t xi = 0; xi < REGION_SIZE; ++xi) {
-                                        auto &[u32_voxel, is_present] = (*palette_region.data)[xi + yi * REGION_SIZE + zi * REGION_SIZE * REGION_SIZE];
-                                        if (!is_present) {
-                                            u32_voxel = 0u;
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                        region_header.variant_n = static_cast<uint32_t>(palette_region.palette.size());
-                        auto bits_per_variant = ceil_log2(region_header.variant_n);
-                        if (region_header.variant_n > MAX_REGION_COMPRESSED_VARIANT_N) {
-                            size = MAX_REGION_ALLOCATION_SIZE;
-                            alloc_region();
-                            uint8_t *output_buffer = local_data.data();
-                            for (uint32_t zi = 0; zi < REGION_SIZE; ++zi) {
-                                for (uint32_t yi = 0; yi < REGION_SIZE; ++yi) {
-                                    for (uint32_t xi = 0; xi < REGION_SIZE; ++xi) {
-                                        auto [u32_voxel, is_present] = (*palette_region.data)[xi + yi * REGION_SIZE + zi * REGION_SIZE * REGION_SIZE];
-                                        write_data<uint32_t>(output_buffer, u32_voxel);
-                                    }
-                                }
-                            }
-                        } else if (region_header.variant_n > 1) {
-                            // insert palette
-                            size += sizeof(uint32_t) * region_header.variant_n;
-                            // insert palette region
-                            size += calc_palette_region_size(bits_per_variant);
-                            alloc_region();
-                            uint8_t *output_buffer = local_data.data();
-                            auto *palette_begin = reinterpret_cast<uint32_t *>(output_buffer);
-                            auto *palette_end = palette_begin + region_header.variant_n;
-                            for (auto u32_voxel : palette_region.palette) {
-                                write_data<uint32_t>(output_buffer, u32_voxel);
-                            }
-                            std::sort(palette_begin, palette_end);
-                            for (uint32_t zi = 0; zi < REGION_SIZE; ++zi) {
-                                for (uint32_t yi = 0; yi < REGION_SIZE; ++yi) {
-                                    for (uint32_t xi = 0; xi < REGION_SIZE; ++xi) {
-                                        auto const in_region_index = xi + yi * REGION_SIZE + zi * REGION_SIZE * REGION_SIZE;
-                                        auto const [u32_voxel, is_present] = (*palette_region.data)[in_region_index];
-                                        auto *iter = std::lower_bound(palette_begin, palette_end, u32_voxel);
-                                        auto palette_id = static_cast<uint32_t>(iter - palette_begin);
-                                        auto const bit_index = static_cast<size_t>(in_region_index) * bits_per_variant;
-                                        auto const byte_index = bit_index / 8;
-                                        auto const bit_offset = static_cast<uint32_t>(bit_index - byte_index * 8);
-                                        auto const mask = get_mask(bits_per_variant);
-                                        if (output_buffer + byte_index + 3 >= local_data.data() + local_data.size()) {
-                                            gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_INVALID_INPUT, "Trying to write past end of buffer, how did this happen?");
-                                            return;
-                                        }
-#if 0
-                                        // Note: This is technically UB, since I think it breaks the strict aliasing rules of C++.
-                                        auto &output = *reinterpret_cast<uint32_t *>(output_buffer + byte_index);
-                                        output = output & ~(mask << bit_offset);
-                                        output = output | static_cast<uint32_t>(palette_id << bit_offset);
-                                        // The "correct" solution is below.
-#else
-                                        auto prev_val = std::bit_cast<uint32_t>(*reinterpret_cast<std::array<uint8_t, 4> *>(output_buffer + byte_index));
-                                        auto output = prev_val & ~(mask << bit_offset);
-                                        output = output | static_cast<uint32_t>(palette_id << bit_offset);
-                                        auto output_bytes = std::bit_cast<std::array<uint8_t, 4>>(output);
-                                        std::copy(output_bytes.begin(), output_bytes.end(), output_buffer + byte_index);
-#endif
-                                    }
-                                }
-                            }
-                        } else if (region_header.variant_n == 1) {
-                            region_header.blob_offset = *palette_region.palette.begin();
-                        } else {
-                            region_header.blob_offset = 0;
-                        }
-                    } else {
-                        region_header.blob_offset = 0;
-                    }
-#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
-                    auto lock = std::lock_guard{data_mutex};
-#endif
-                    auto *channel_header_ptr =
-                        user_state.data.data() +
-                        (rxi + ryi * user_state.region_nx + rzi * user_state.region_nx * user_state.region_ny) *
-                            (sizeof(ChannelHeader) * user_state.channels.size()) +
-                        (sizeof(ChannelHeader) * ci);
-                    write_data<ChannelHeader>(channel_header_ptr, region_header);
-                    if (region_header.variant_n > 1) {
-                        std::copy(local_data.begin(), local_data.end(), user_state.data.data() + user_state.blobs_begin + region_header.blob_offset);
-                    }
+// Enough bricks per job that splitting and stealing cost nothing next to the encoding itself
+static constexpr auto BLIT_END_BRICK_GRAIN = uint32_t{64};
+
+// Fills in the header's variant_n (and the value itself for single-variant bricks) and returns the blob size
+template <size_t REGION_SIZE>
+static auto finalize_palette_region(StagingArena &arena, PaletteRegion &palette_region, ChannelHeaderV2 &region_header, BrickEncodeScratch<REGION_SIZE> &scratch) -> size_t {
+    region_header.variant_n = 0;
+    if (palette_region.accounted_for == 0) {
+        return 0;
+    }
+    // Missing voxels are already 0, so they're counted as such without any special casing
+    auto &value_set = scratch.values;
+    value_set.clear();
+    for (uint32_t i = 0; i < BRICK_VOXEL_N<REGION_SIZE>; ++i) {
+        value_set.insert(palette_region.values[i]);
+    }
+    region_header.variant_n = value_set.size;
+    palette_region.variant_n = value_set.size;
+    if (region_header.variant_n > MAX_REGION_COMPRESSED_VARIANT_N<REGION_SIZE>) {
+        return MAX_REGION_ALLOCATION_SIZE<REGION_SIZE>;
+    }
+    if (region_header.variant_n > 1) {
+        palette_region.palette = arena.allocate(value_set.size);
+        std::copy_n(value_set.values.begin(), value_set.size, palette_region.palette);
+        std::sort(palette_region.palette, palette_region.palette + value_set.size);
+        return sizeof(uint32_t) * region_header.variant_n + calc_palette_region_size(REGION_SIZE, ceil_log2(region_header.variant_n));
+    }
+    region_header.blob_offset = value_set.values[0];
+    return 0;
+}
+
+// A brick's encoding only depends on its voxel values (missing ones having been zeroed by finalize_palette_region),
+// so two bricks with the same values can share a blob
+template <size_t REGION_SIZE>
+static auto hash_palette_region(PaletteRegion const &palette_region) -> uint64_t {
+    auto result = uint64_t{0};
+    for (uint32_t i = 0; i < BRICK_VOXEL_N<REGION_SIZE>; ++i) {
+        result = (result ^ palette_region.values[i]) * 0x9e3779b97f4a7c15;
+        result ^= result >> 29;
+    }
+    return result;
+}
+
+template <size_t REGION_SIZE>
+static auto is_same_palette_region(PaletteRegion const &a, PaletteRegion const &b) -> bool {
+    return std::equal(a.values, a.values + BRICK_VOXEL_N<REGION_SIZE>, b.values);
+}
+
+template <size_t REGION_SIZE>
+static void encode_palette_region(GvoxAdapterContext *ctx, PaletteRegion const &palette_region, ChannelHeaderV2 const &region_header, uint8_t *blob, size_t blob_size, BrickEncodeScratch<REGION_SIZE> &scratch) {
+    uint8_t *output_buffer = blob;
+    if (region_header.variant_n > MAX_REGION_COMPRESSED_VARIANT_N<REGION_SIZE>) {
+        std::memcpy(output_buffer, palette_region.values, MAX_REGION_ALLOCATION_SIZE<REGION_SIZE>);
+        return;
+    }
+    auto const bits_per_variant = ceil_log2(region_header.variant_n);
+    if (sizeof(uint32_t) * region_header.variant_n + REGION_SIZE * REGION_SIZE * REGION_SIZE * bits_per_variant / 8 > blob_size) {
+        gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_PARSE_ADAPTER_INVALID_INPUT, "Trying to write past end of buffer, how did this happen?");
+        return;
+    }
+    // The palette is sorted, so inserting it in order numbers each value by its position
+    auto &value_indices = scratch.values;
+    value_indices.clear();
+    for (auto u32_voxel : std::span{palette_region.palette, palette_region.variant_n}) {
+        value_indices.insert(u32_voxel);
+        write_data<uint32_t>(output_buffer, u32_voxel);
+    }
+    auto &indices = scratch.indices;
+    for (uint32_t in_region_index = 0; in_region_index < indices.size(); ++in_region_index) {
+        indices[in_region_index] = static_cast<uint16_t>(value_indices.insert(palette_region.values[in_region_index]));
+    }
+    pack_brick_indices<REGION_SIZE>(indices, bits_per_variant, output_buffer);
+    // The blob ends in a padding word that the indices never reach, and the blob may be reused scratch memory
+    auto const packed_size = static_cast<size_t>(output_buffer - blob) + REGION_SIZE * REGION_SIZE * REGION_SIZE * bits_per_variant / 8;
+    std::memset(blob + packed_size, 0, blob_size - packed_size);
+}
+
+// Finalizes, encodes and writes the staged bricks [brick_begin, brick_end), which must be whole z slabs, placing
+// their blobs after the ones written so far. Their staging memory is released afterwards.
+template <size_t REGION_SIZE>
+static void write_bricks(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxPaletteSerializeUserState &user_state, uint32_t brick_begin, uint32_t brick_end) {
+    auto const brick_n = brick_end - brick_begin;
+    auto const channel_n = static_cast<uint32_t>(user_state.channels.size());
+    auto region_headers = std::vector<ChannelHeaderV2>(static_cast<size_t>(brick_n) * channel_n, ChannelHeaderV2{.variant_n = 1u, .compressed_size = 0u, .blob_offset = 0u});
+    auto blob_sizes = std::vector<size_t>(region_headers.size());
+    auto blob_hashes = std::vector<uint64_t>(region_headers.size());
+    auto &thread_pool = get_thread_pool(ctx);
+    // All blob sizes are computed before anything is encoded, so that every brick knows its offset up front and
+    // can be written straight into place. The layout is the same as encoding the bricks one after another.
+    parallel_for(thread_pool, brick_begin, brick_end, BLIT_END_BRICK_GRAIN, [&](uint32_t chunk_begin, uint32_t chunk_end) {
+        auto scratch = BrickScratch<REGION_SIZE, BrickEncodeScratch<REGION_SIZE>>{};
+        for (uint32_t brick_i = chunk_begin; brick_i < chunk_end; ++brick_i) {
+            auto &palette_region_channel = user_state.palette_region_channels[brick_i];
+            if (palette_region_channel.size() != channel_n) {
+                continue;
+            }
+            for (uint32_t ci = 0; ci < channel_n; ++ci) {
+                auto const header_i = static_cast<size_t>(brick_i - brick_begin) * channel_n + ci;
+                blob_sizes[header_i] = finalize_palette_region<REGION_SIZE>(user_state.get_arena(brick_i), palette_region_channel[ci], region_headers[header_i], *scratch);
+                if (region_headers[header_i].variant_n > 1) {
+                    blob_hashes[header_i] = hash_palette_region<REGION_SIZE>(palette_region_channel[ci]);
+                }
+            }
+        }
+    });
+    auto const get_palette_region = [&](size_t header_i) -> PaletteRegion const & {
+        return user_state.palette_region_channels[brick_begin + header_i / channel_n][header_i % channel_n];
+    };
+    // Repeated bricks (instanced models, say) point at the blob of the first one, and are never encoded themselves
+    auto blob_owners = std::vector<size_t>(region_headers.size());
+    {
+        auto first_with_hash = std::unordered_map<uint64_t, size_t>{};
+        for (size_t header_i = 0; header_i < region_headers.size(); ++header_i) {
+            blob_owners[header_i] = header_i;
+            if (region_headers[header_i].variant_n <= 1) {
+                continue;
+            }
+            auto const [iter, is_new] = first_with_hash.emplace(blob_hashes[header_i], header_i);
+            if (!is_new && is_same_palette_region<REGION_SIZE>(get_palette_region(iter->second), get_palette_region(header_i))) {
+                blob_owners[header_i] = iter->second;
+            }
+        }
+    }
+    auto const is_v1 = user_state.config.version == 1;
+    // A brick's compressed size is only known once it's been encoded, so compressed bricks are encoded (and
+    // compressed) before the offsets are assigned and kept around until they can be copied into place
+    auto compressed_blobs = std::vector<std::vector<uint8_t>>{};
+    if (user_state.config.compression == GVOX_GVOX_PALETTE_SERIALIZE_ADAPTER_COMPRESSION_LZ) {
+        compressed_blobs.resize(region_headers.size());
+        parallel_for(thread_pool, 0, static_cast<uint32_t>(region_headers.size()), BLIT_END_BRICK_GRAIN, [&](uint32_t chunk_begin, uint32_t chunk_end) {
+            auto encoded = BrickScratch<REGION_SIZE, std::array<uint8_t, MAX_REGION_ALLOCATION_SIZE<REGION_SIZE>>>{};
+            auto compressed = BrickScratch<REGION_SIZE, std::array<uint8_t, MAX_REGION_ALLOCATION_SIZE<REGION_SIZE>>>{};
+            auto scratch = BrickScratch<REGION_SIZE, BrickEncodeScratch<REGION_SIZE>>{};
+            for (uint32_t header_i = chunk_begin; header_i < chunk_end; ++header_i) {
+                auto &region_header = region_headers[header_i];
+                if (region_header.variant_n <= 1 || blob_owners[header_i] != header_i) {
+                    continue;
                 }
+                encode_palette_region<REGION_SIZE>(ctx, get_palette_region(header_i), region_header, encoded->data(), blob_sizes[header_i], *scratch);
+                // Only kept if it's actually smaller
+                auto const compressed_size = gvox_detail::lz::compress(encoded->data(), blob_sizes[header_i], compressed->data(), blob_sizes[header_i] - 1);
+                if (compressed_size != 0) {
+                    region_header.compressed_size = static_cast<uint32_t>(compressed_size);
+                    compressed_blobs[header_i].assign(compressed->data(), compressed->data() + compressed_size);
+                }
+            }
+        });
+    }
+    auto brick_order = std::vector<uint32_t>(brick_n);
+    for (uint32_t brick_i = 0; brick_i < brick_n; ++brick_i) {
+        brick_order[brick_i] = brick_begin + brick_i;
+    }
+    if (!is_v1) {
+        auto const morton_index = [&](uint32_t brick_i) {
+            return morton_encode(
+                brick_i % user_state.region_nx,
+                (brick_i / user_state.region_nx) % user_state.region_ny,
+                brick_i / (user_state.region_nx * user_state.region_ny));
+        };
+        std::sort(brick_order.begin(), brick_order.end(), [&](uint32_t a, uint32_t b) {
+            return morton_index(a) < morton_index(b);
+        });
+    }
+    // Compressed blobs are padded to a whole number of words, so that every blob stays 4 byte aligned
+    auto blob_size = size_t{0};
+    for (auto const brick_i : brick_order) {
+        for (uint32_t ci = 0; ci < channel_n; ++ci) {
+            auto const header_i = static_cast<size_t>(brick_i - brick_begin) * channel_n + ci;
+            if (region_headers[header_i].variant_n > 1 && blob_owners[header_i] == header_i) {
+                region_headers[header_i].blob_offset = blob_size;
+                auto const compressed_size = size_t{region_headers[header_i].compressed_size};
+                blob_size += compressed_size != 0 ? (compressed_size + 3) / 4 * 4 : blob_sizes[header_i];
             }
         }
     }
-    while (user_state.thread_pool.busy()) {
+    for (size_t header_i = 0; header_i < region_headers.size(); ++header_i) {
+        if (blob_owners[header_i] != header_i) {
+            region_headers[header_i].blob_offset = region_headers[blob_owners[header_i]].blob_offset;
+            region_headers[header_i].compressed_size = region_headers[blob_owners[header_i]].compressed_size;
+        }
+    }
+    if (is_v1 && user_state.blob_size + blob_size > UINT32_MAX) {
+        gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_SERIALIZE_ADAPTER_UNREPRESENTABLE_DATA, "version 1 of gvox_palette can't hold more than 4GiB of brick data, use version 2");
+        return;
+    }
+    auto blobs = std::vector<uint8_t>(blob_size);
+    parallel_for(thread_pool, 0, static_cast<uint32_t>(region_headers.size()), BLIT_END_BRICK_GRAIN, [&](uint32_t chunk_begin, uint32_t chunk_end) {
+        auto scratch = BrickScratch<REGION_SIZE, BrickEncodeScratch<REGION_SIZE>>{};
+        for (uint32_t header_i = chunk_begin; header_i < chunk_end; ++header_i) {
+            auto const &region_header = region_headers[header_i];
+            if (blob_owners[header_i] != header_i) {
+                continue;
+            }
+            if (region_header.compressed_size != 0) {
+                std::copy(compressed_blobs[header_i].begin(), compressed_blobs[header_i].end(), blobs.begin() + static_cast<std::ptrdiff_t>(region_header.blob_offset));
+            } else if (region_header.variant_n > 1) {
+                encode_palette_region<REGION_SIZE>(ctx, get_palette_region(header_i), region_header, blobs.data() + region_header.blob_offset, blob_sizes[header_i], *scratch);
+            }
+        }
+    });
+
+    auto const header_size = is_v1 ? sizeof(ChannelHeader) : sizeof(ChannelHeaderV2);
+    auto header_bytes = std::vector<uint8_t>(region_headers.size() * header_size);
+    for (size_t header_i = 0; header_i < region_headers.size(); ++header_i) {
+        auto region_header = region_headers[header_i];
+        if (region_header.variant_n > 1) {
+            region_header.blob_offset += user_state.blob_size;
+        }
+        if (is_v1) {
+            auto const v1_header = ChannelHeader{.variant_n = region_header.variant_n, .blob_offset = static_cast<uint32_t>(region_header.blob_offset)};
+            std::memcpy(header_bytes.data() + header_i * header_size, &v1_header, sizeof(v1_header));
+        } else {
+            std::memcpy(header_bytes.data() + header_i * header_size, &region_header, sizeof(region_header));
+        }
+    }
+    gvox_output_write(blit_ctx, user_state.offset + static_cast<size_t>(brick_begin) * channel_n * header_size, header_bytes.size(), header_bytes.data());
+    if (!blobs.empty()) {
+        gvox_output_write(blit_ctx, user_state.offset + user_state.blobs_begin + user_state.blob_size, blobs.size(), blobs.data());
+    }
+    user_state.blob_size += blob_size;
+
+    for (uint32_t brick_i = brick_begin; brick_i < brick_end; ++brick_i) {
+        user_state.palette_region_channels[brick_i] = {};
+    }
+}
+
+static thread_local bool is_writing_slabs = false;
+
+// Writes every slab that's been completely handled and directly follows the ones already written. Only one thread
+// writes at a time, and the others don't wait for it, since it checks for newly completed slabs before it stops.
+static void write_completed_slabs(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxPaletteSerializeUserState &user_state) {
+    // This thread may be helping out with other jobs while it waits for its own writes to be encoded
+    if (is_writing_slabs) {
+        return;
+    }
+    auto const slab_brick_n = user_state.region_nx * user_state.region_ny;
+    auto const is_next_slab_complete = [&]() {
+        auto const slab_i = user_state.written_slab_n.load();
+        return slab_i < user_state.region_nz && user_state.slab_handled_brick_ns[slab_i].load() == slab_brick_n;
+    };
+    while (is_next_slab_complete()) {
 #if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
-        std::this_thread::sleep_for(10ms);
+        auto lock = std::unique_lock{user_state.write_mtx, std::try_to_lock};
+        if (!lock.owns_lock()) {
+            return;
+        }
 #endif
+        is_writing_slabs = true;
+        while (is_next_slab_complete()) {
+            auto const slab_i = user_state.written_slab_n.load();
+            dispatch_region_size(user_state.config.brick_size, [&](auto region_size) {
+                write_bricks<region_size>(blit_ctx, ctx, user_state, slab_i * slab_brick_n, (slab_i + 1) * slab_brick_n);
+            });
+            user_state.arenas[slab_i].clear();
+            user_state.written_slab_n.store(slab_i + 1);
+        }
+        is_writing_slabs = false;
     }
-    user_state.thread_pool.stop();
-    auto blob_size = static_cast<uint32_t>(user_state.data.size() - user_state.blobs_begin);
-    gvox_output_write(blit_ctx, user_state.blob_size_offset, sizeof(blob_size), &blob_size);
-    gvox_output_write(blit_ctx, user_state.offset, user_state.data.size(), user_state.data.data());
 }
 
-static void handle_single_palette(
-    GvoxBlitContext *blit_ctx, GvoxPaletteSerializeUserState &user_state, PaletteRegion &palette_region,
-    GvoxRegion *region_ptr, uint32_t channel_id, uint32_t ox, uint32_t oy, uint32_t oz) {
-    bool at_least_one_present = false;
-    for (uint32_t zi = 0; zi < REGION_SIZE; ++zi) {
-        for (uint32_t yi = 0; yi < REGION_SIZE; ++yi) {
-            for (uint32_t xi = 0; xi < REGION_SIZE; ++xi) {
-                auto const px = ox + xi;
-                auto const py = oy + yi;
-                auto const pz = oz + zi;
-                auto pos = GvoxOffset3D{
-                    .x = static_cast<int32_t>(px) + user_state.range.offset.x,
-                    .y = static_cast<int32_t>(py) + user_state.range.offset.y,
-                    .z = static_cast<int32_t>(pz) + user_state.range.offset.z,
-                };
-                if (px < user_state.range.extent.x && py < user_state.range.extent.y && pz < user_state.range.extent.z) {
-                    auto sample = gvox_sample_region(blit_ctx, region_ptr, &pos, channel_id);
-                    if (sample.is_present != 0u) {
-                        palette_region.palette.insert(sample.data);
-                        at_least_one_present = true;
-                    }
-                }
+extern "C" void gvox_serialize_adapter_gvox_palette_blit_end(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx) {
+    auto &user_state = *static_cast<GvoxPaletteSerializeUserState *>(gvox_adapter_get_user_pointer(ctx));
+    auto const slab_brick_n = user_state.region_nx * user_state.region_ny;
+    dispatch_region_size(user_state.config.brick_size, [&](auto region_size) {
+        if (user_state.config.streaming != 0) {
+            // Whatever wasn't written as the blit went (all of it, for parse driven blits)
+            for (auto slab_i = user_state.written_slab_n.load(); slab_i < user_state.region_nz; ++slab_i) {
+                write_bricks<region_size>(blit_ctx, ctx, user_state, slab_i * slab_brick_n, (slab_i + 1) * slab_brick_n);
+                user_state.arenas[slab_i].clear();
+            }
+        } else {
+            write_bricks<region_size>(blit_ctx, ctx, user_state, 0, slab_brick_n * user_state.region_nz);
+        }
+    });
+    if (user_state.config.version == 1) {
+        auto const blob_size_u32 = static_cast<uint32_t>(user_state.blob_size);
+        gvox_output_write(blit_ctx, user_state.blob_size_offset, sizeof(blob_size_u32), &blob_size_u32);
+    } else {
+        auto const blob_size_u64 = static_cast<uint64_t>(user_state.blob_size);
+        gvox_output_write(blit_ctx, user_state.blob_size_offset, sizeof(blob_size_u64), &blob_size_u64);
+    }
+    user_state.palette_region_channels.clear();
+    user_state.arenas.reset();
+}
+
+// General
+extern "C" auto gvox_serialize_adapter_gvox_palette_query_details() -> GvoxSerializeAdapterDetails {
+    return {
+        .supports_concurrent_serialization = 1,
+    };
+}
+
+template <size_t REGION_SIZE>
+static void sample_palette_region(
+    GvoxBlitContext *blit_ctx, GvoxPaletteSerializeUserState &user_state,
+    GvoxRegion const *region_ptr, uint32_t channel_id, uint32_t ox, uint32_t oy, uint32_t oz,
+    std::array<GvoxSample, BRICK_VOXEL_N<REGION_SIZE>> &samples) {
+    auto const ex = static_cast<uint32_t>(std::min<size_t>(REGION_SIZE, user_state.range.extent.x - ox));
+    auto const ey = static_cast<uint32_t>(std::min<size_t>(REGION_SIZE, user_state.range.extent.y - oy));
+    auto const ez = static_cast<uint32_t>(std::min<size_t>(REGION_SIZE, user_state.range.extent.z - oz));
+    auto const sample_range = GvoxRegionRange{
+        .offset = GvoxOffset3D{
+            .x = static_cast<int32_t>(ox) + user_state.range.offset.x,
+            .y = static_cast<int32_t>(oy) + user_state.range.offset.y,
+            .z = static_cast<int32_t>(oz) + user_state.range.offset.z,
+        },
+        .extent = GvoxExtent3D{ex, ey, ez},
+    };
+    if (region_ptr == nullptr) {
+        // Serialize driven, so the whole brick can be fetched at once. If anything is missing, we fall back
+        // to sampling, since the dense path doesn't tell us which voxels weren't present.
+        auto voxels = BrickScratch<REGION_SIZE, std::array<uint32_t, BRICK_VOXEL_N<REGION_SIZE>>>{};
+        auto const strides = GvoxStrides3D{1, REGION_SIZE, REGION_SIZE * REGION_SIZE};
+        if (gvox_load_region_dense(blit_ctx, &sample_range, channel_id, voxels->data(), &strides) != 0u) {
+            for (uint32_t i = 0; i < voxels->size(); ++i) {
+                auto const xi = i % REGION_SIZE;
+                auto const yi = (i / REGION_SIZE) % REGION_SIZE;
+                auto const zi = i / (REGION_SIZE * REGION_SIZE);
+                auto const is_inside = xi < ex && yi < ey && zi < ez;
+                samples[i] = {is_inside ? (*voxels)[i] : 0u, static_cast<uint8_t>(is_inside)};
             }
+            return;
         }
     }
-    if (at_least_one_present) {
-        if (!palette_region.data) {
-            palette_region.data = std::make_unique<decltype(PaletteRegion::data)::element_type>(decltype(PaletteRegion::data)::element_type{});
+    auto offsets = BrickScratch<REGION_SIZE, std::array<GvoxOffset3D, BRICK_VOXEL_N<REGION_SIZE>>>{};
+    auto sample_n = uint32_t{0};
+    for (uint32_t zi = 0; zi < ez; ++zi) {
+        for (uint32_t yi = 0; yi < ey; ++yi) {
+            for (uint32_t xi = 0; xi < ex; ++xi) {
+                (*offsets)[sample_n++] = GvoxOffset3D{
+                    .x = static_cast<int32_t>(xi) + sample_range.offset.x,
+                    .y = static_cast<int32_t>(yi) + sample_range.offset.y,
+                    .z = static_cast<int32_t>(zi) + sample_range.offset.z,
+                };
+            }
         }
-        for (uint32_t zi = 0; zi < REGION_SIZE; ++zi) {
-            for (uint32_t yi = 0; yi < REGION_SIZE; ++yi) {
-                for (uint32_t xi = 0; xi < REGION_SIZE; ++xi) {
-                    auto palette_region_index = xi + yi * REGION_SIZE + zi * REGION_SIZE * REGION_SIZE;
-                    auto const px = ox + xi;
-                    auto const py = oy + yi;
-                    auto const pz = oz + zi;
-                    auto u32_voxel = 0u;
-                    auto is_present = false;
-                    auto pos = GvoxOffset3D{
-                        .x = static_cast<int32_t>(px) + user_state.range.offset.x,
-                        .y = static_cast<int32_t>(py) + user_state.range.offset.y,
-                        .z = static_cast<int32_t>(pz) + user_state.range.offset.z,
-                    };
-                    if (px < user_state.range.extent.x && py < user_state.range.extent.y && pz < user_state.range.extent.z) {
-                        auto sample = gvox_sample_region(blit_ctx, region_ptr, &pos, channel_id);
-                        u32_voxel = sample.data;
-                        is_present = (sample.is_present != 0u);
-                    }
-                    auto const [prev_u32_voxel, prev_present] = (*palette_region.data)[palette_region_index];
-                    if (!prev_present && is_present) {
-                        (*palette_region.data)[palette_region_index] = {u32_voxel, is_present};
-                        ++palette_region.accounted_for;
-                    }
+    }
+    auto temp_region = GvoxRegion{};
+    if (region_ptr == nullptr) {
+        temp_region = gvox_load_region_range(blit_ctx, &sample_range, 1u << channel_id);
+    }
+    // Sampled in place, then spread out from the back so that each sample lands at its brick index
+    gvox_sample_region_batch(blit_ctx, region_ptr != nullptr ? region_ptr : &temp_region, offsets->data(), samples.data(), sample_n, channel_id);
+    if (region_ptr == nullptr) {
+        gvox_unload_region_range(blit_ctx, &temp_region, &sample_range);
+    }
+    for (uint32_t zi = REGION_SIZE; zi-- > 0;) {
+        for (uint32_t yi = REGION_SIZE; yi-- > 0;) {
+            for (uint32_t xi = REGION_SIZE; xi-- > 0;) {
+                auto const palette_region_index = xi + yi * REGION_SIZE + zi * REGION_SIZE * REGION_SIZE;
+                if (xi < ex && yi < ey && zi < ez) {
+                    samples[palette_region_index] = samples[--sample_n];
+                } else {
+                    samples[palette_region_index] = {0u, 0u};
                 }
             }
         }
     }
 }
 
-static void handle_region(GvoxBlitContext *blit_ctx, GvoxPaletteSerializeUserState &user_state, GvoxRegionRange const *range, GvoxRegion *region_ptr) {
-    auto temp_region = GvoxRegion{};
-    if (region_ptr != nullptr) {
-        temp_region = *region_ptr;
+// In serialize driven blits, the parser may know that a brick is uniform (all air or stone, say), in which case
+// one sample per channel is enough to fill it in. Returns false if it isn't, or the parser can't tell.
+template <size_t REGION_SIZE>
+static auto load_uniform_brick_values(GvoxBlitContext *blit_ctx, GvoxPaletteSerializeUserState &user_state, uint32_t ox, uint32_t oy, uint32_t oz, std::span<uint32_t> values) -> bool {
+    auto const brick_range = GvoxRegionRange{
+        .offset = GvoxOffset3D{
+            .x = static_cast<int32_t>(ox) + user_state.range.offset.x,
+            .y = static_cast<int32_t>(oy) + user_state.range.offset.y,
+            .z = static_cast<int32_t>(oz) + user_state.range.offset.z,
+        },
+        .extent = GvoxExtent3D{
+            static_cast<uint32_t>(std::min<size_t>(REGION_SIZE, user_state.range.extent.x - ox)),
+            static_cast<uint32_t>(std::min<size_t>(REGION_SIZE, user_state.range.extent.y - oy)),
+            static_cast<uint32_t>(std::min<size_t>(REGION_SIZE, user_state.range.extent.z - oz)),
+        },
+    };
+    if ((gvox_query_region_flags(blit_ctx, &brick_range, user_state.channel_flags) & GVOX_REGION_FLAG_UNIFORM) == 0) {
+        return false;
+    }
+    auto const sample_range = GvoxRegionRange{.offset = brick_range.offset, .extent = {1, 1, 1}};
+    auto region = gvox_load_region_range(blit_ctx, &sample_range, user_state.channel_flags);
+    auto all_present = true;
+    for (uint32_t ci = 0; ci < user_state.channels.size(); ++ci) {
+        auto const sample = gvox_sample_region(blit_ctx, &region, &sample_range.offset, user_state.channels[ci]);
+        values[ci] = sample.data;
+        all_present = all_present && sample.is_present != 0u;
     }
+    gvox_unload_region_range(blit_ctx, &region, &sample_range);
+    return all_present;
+}
+
+template <size_t REGION_SIZE>
+static void fill_uniform_palette_region(
+    GvoxPaletteSerializeUserState &user_state, uint32_t ox, uint32_t oy, uint32_t oz, uint32_t value,
+    std::array<GvoxSample, BRICK_VOXEL_N<REGION_SIZE>> &samples) {
+    auto const ex = static_cast<uint32_t>(std::min<size_t>(REGION_SIZE, user_state.range.extent.x - ox));
+    auto const ey = static_cast<uint32_t>(std::min<size_t>(REGION_SIZE, user_state.range.extent.y - oy));
+    auto const ez = static_cast<uint32_t>(std::min<size_t>(REGION_SIZE, user_state.range.extent.z - oz));
+    for (uint32_t i = 0; i < samples.size(); ++i) {
+        auto const xi = i % REGION_SIZE;
+        auto const yi = (i / REGION_SIZE) % REGION_SIZE;
+        auto const zi = i / (REGION_SIZE * REGION_SIZE);
+        samples[i] = {value, static_cast<uint8_t>(xi < ex && yi < ey && zi < ez)};
+    }
+}
+
+// `uniform_value` is non-null if the brick is already known to be uniform
+template <size_t REGION_SIZE>
+static void handle_single_palette(
+    GvoxBlitContext *blit_ctx, GvoxPaletteSerializeUserState &user_state, PaletteRegion &palette_region, uint32_t brick_index,
+    GvoxRegion const *region_ptr, uint32_t channel_id, uint32_t ox, uint32_t oy, uint32_t oz, uint32_t const *uniform_value) {
+    auto samples_scratch = BrickScratch<REGION_SIZE, std::array<GvoxSample, BRICK_VOXEL_N<REGION_SIZE>>>{};
+    auto &samples = *samples_scratch;
+    if (uniform_value != nullptr) {
+        fill_uniform_palette_region<REGION_SIZE>(user_state, ox, oy, oz, *uniform_value, samples);
+    } else {
+        sample_palette_region<REGION_SIZE>(blit_ctx, user_state, region_ptr, channel_id, ox, oy, oz, samples);
+    }
+    auto const at_least_one_present = std::any_of(samples.begin(), samples.end(), [](GvoxSample const &sample) {
+        return sample.is_present != 0u;
+    });
+    if (!at_least_one_present) {
+        return;
+    }
+    if (palette_region.values == nullptr) {
+        palette_region.values = user_state.get_arena(brick_index).allocate(BRICK_VOXEL_N<REGION_SIZE> + BRICK_VOXEL_N<REGION_SIZE> / 32);
+        palette_region.present = palette_region.values + BRICK_VOXEL_N<REGION_SIZE>;
+        std::fill_n(palette_region.values, BRICK_VOXEL_N<REGION_SIZE> + BRICK_VOXEL_N<REGION_SIZE> / 32, 0u);
+    }
+    // The first region to provide a voxel wins, the palette itself is only built from what's kept in blit_end
+    for (uint32_t palette_region_index = 0; palette_region_index < samples.size(); ++palette_region_index) {
+        auto const &sample = samples[palette_region_index];
+        auto &present_word = palette_region.present[palette_region_index / 32];
+        auto const present_bit = uint32_t{1} << (palette_region_index % 32);
+        if ((present_word & present_bit) == 0 && sample.is_present != 0u) {
+            palette_region.values[palette_region_index] = sample.data;
+            present_word |= present_bit;
+            ++palette_region.accounted_for;
+        }
+    }
+}
+
+template <size_t REGION_SIZE>
+static void handle_region(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxPaletteSerializeUserState &user_state, GvoxRegionRange const *range, GvoxRegion const *region_ptr) {
     auto range_min = GvoxOffset3D{
         std::max(range->offset.x, user_state.range.offset.x),
         std::max(range->offset.y, user_state.range.offset.y),
@@ -321,82 +745,48 @@ static void handle_region(GvoxBlitContext *blit_ctx, GvoxPaletteSerializeUserSta
     for (uint32_t rzi = rz_min; rzi < rz_max; ++rzi) {
         for (uint32_t ryi = ry_min; ryi < ry_max; ++ryi) {
             for (uint32_t rxi = rx_min; rxi < rx_max; ++rxi) {
+                auto const brick_index = rxi + ryi * user_state.region_nx + rzi * user_state.region_nx * user_state.region_ny;
 #if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
-                auto &mutex = (*user_state.palette_region_channels_mutexes)[rxi + ryi * user_state.region_nx + rzi * user_state.region_nx * user_state.region_ny];
+                auto &mutex = (*user_state.palette_region_channels_mutexes)[brick_index];
                 auto lock = std::lock_guard{mutex};
 #endif
-                auto &palette_region_channel = user_state.palette_region_channels[rxi + ryi * user_state.region_nx + rzi * user_state.region_nx * user_state.region_ny];
+                auto &palette_region_channel = user_state.palette_region_channels[brick_index];
                 palette_region_channel.resize(user_state.channels.size());
+                auto const ox = rxi * static_cast<uint32_t>(REGION_SIZE);
+                auto const oy = ryi * static_cast<uint32_t>(REGION_SIZE);
+                auto const oz = rzi * static_cast<uint32_t>(REGION_SIZE);
+                auto uniform_values = std::array<uint32_t, 32>{};
+                auto const is_uniform = region_ptr == nullptr && load_uniform_brick_values<REGION_SIZE>(blit_ctx, user_state, ox, oy, oz, uniform_values);
                 for (uint32_t ci = 0; ci < palette_region_channel.size(); ++ci) {
                     auto &palette_region = palette_region_channel.at(ci);
-                    auto const ox = rxi * static_cast<uint32_t>(REGION_SIZE);
-                    auto const oy = ryi * static_cast<uint32_t>(REGION_SIZE);
-                    auto const oz = rzi * static_cast<uint32_t>(REGION_SIZE);
                     auto channel_id = user_state.channels[ci];
-                    auto const sample_range = GvoxRegionRange{
-                        .offset = GvoxOffset3D{
-                            .x = static_cast<int32_t>(ox) + user_state.range.offset.x,
-                            .y = static_cast<int32_t>(oy) + user_state.range.offset.y,
-                            .z = static_cast<int32_t>(oz) + user_state.range.offset.z,
-                        },
-                        .extent = GvoxExtent3D{REGION_SIZE, REGION_SIZE, REGION_SIZE},
-                    };
-                    if (region_ptr == nullptr) {
-                        temp_region = gvox_load_region_range(blit_ctx, &sample_range, 1u << channel_id);
-                    }
-                    handle_single_palette(
-                        blit_ctx, user_state, palette_region,
-                        &temp_region, channel_id, ox, oy, oz);
-                    if (region_ptr == nullptr) {
-                        gvox_unload_region_range(blit_ctx, &temp_region, &sample_range);
-                    }
+                    handle_single_palette<REGION_SIZE>(
+                        blit_ctx, user_state, palette_region, brick_index,
+                        region_ptr, channel_id, ox, oy, oz, is_uniform ? &uniform_values[ci] : nullptr);
                 }
             }
         }
+        // Serialize driven blits handle every brick exactly once, so a slab is done once all its bricks have been.
+        // Parse driven ones make no such promise, so they're all written in blit_end.
+        if (user_state.config.streaming != 0 && region_ptr == nullptr) {
+            user_state.slab_handled_brick_ns[rzi].fetch_add((rx_max - rx_min) * (ry_max - ry_min));
+            write_completed_slabs(blit_ctx, ctx, user_state);
+        }
     }
 }
 
 // Serialize Driven
 extern "C" void gvox_serialize_adapter_gvox_palette_serialize_region(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t /*channel_flags*/) {
     auto &user_state = *static_cast<GvoxPaletteSerializeUserState *>(gvox_adapter_get_user_pointer(ctx));
-    user_state.thread_pool.start();
-#define IMPL(axis)                                                                                                                                   \
-    auto per_thread_size = range->extent.axis / 32;                                                                                                  \
-    if (per_thread_size > 0) {                                                                                                                       \
-        for (uint32_t i = 0; i < 32; ++i) {                                                                                                          \
-            user_state.thread_pool.enqueue([blit_ctx, &user_state, range, per_thread_size, i]() {                                                    \
-                auto temp_range = *range;                                                                                                            \
-                temp_range.extent.axis = per_thread_size;                                                                                            \
-                temp_range.offset.axis = range->offset.axis + static_cast<int32_t>(per_thread_size * i);                                             \
-                handle_region(blit_ctx, user_state, &temp_range, nullptr);                                                                           \
-            });                                                                                                                                      \
-        }                                                                                                                                            \
-    }                                                                                                                                                \
-    auto temp_range = *range;                                                                                                                        \
-    temp_range.extent.axis = range->extent.axis % 32;                                                                                                \
-    temp_range.offset.axis = range->offset.axis + static_cast<int32_t>(user_state.range.extent.axis) - static_cast<int32_t>(temp_range.extent.axis); \
-    if (range->extent.axis > 0) {                                                                                                                    \
-        handle_region(blit_ctx, user_state, &temp_range, nullptr);                                                                                   \
-    }
-    auto max_axis = std::max({range->extent.x, range->extent.y, range->extent.z});
-    if (max_axis == range->extent.x) {
-        IMPL(x)
-    } else if (max_axis == range->extent.y) {
-        IMPL(y)
-    } else {
-        IMPL(z)
-    }
-    while (user_state.thread_pool.busy()) {
-#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
-        std::this_thread::sleep_for(10ms);
-#endif
-    }
-    user_state.thread_pool.stop();
+    dispatch_region_size(user_state.config.brick_size, [&](auto region_size) {
+        handle_region<region_size>(blit_ctx, ctx, user_state, range, nullptr);
+    });
 }
 
 // Parse Driven
 extern "C" void gvox_serialize_adapter_gvox_palette_receive_region(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion const *region) {
     auto &user_state = *static_cast<GvoxPaletteSerializeUserState *>(gvox_adapter_get_user_pointer(ctx));
-    auto temp_region = *region;
-    handle_region(blit_ctx, user_state, &region->range, &temp_region);
+    dispatch_region_size(user_state.config.brick_size, [&](auto region_size) {
+        handle_region<region_size>(blit_ctx, ctx, user_state, &region->range, region);
+    });
 }
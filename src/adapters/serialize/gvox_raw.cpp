@@ -1,24 +1,130 @@
 #include <gvox/gvox.h>
 #include <gvox/adapters/serialize/gvox_raw.h>
 
+#include "../shared/gvox_raw.hpp"
+
 #include <cstdlib>
 
 #include <bit>
 #include <array>
 #include <vector>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+// Serialize-driven blits are loaded a brick at a time, so that uniform bricks can be filled without sampling
+static constexpr auto BRICK_SIZE = uint32_t{16};
 
 struct GvoxRawUserState {
+    GvoxGvoxRawSerializeAdapterConfig config{};
     GvoxRegionRange range{};
-    std::vector<uint32_t> voxels;
     std::vector<uint8_t> channels;
+    // Voxels are staged in z slabs, which are allocated when first touched and released once written. Without
+    // streaming, a single slab spans the whole range.
+    uint32_t slab_depth{};
+    uint32_t slab_n{};
+    std::vector<std::unique_ptr<uint32_t[]>> slabs{};
+    std::mutex slab_mtx{};
+    // Streaming state: how many voxels of each slab have been handled, and how many slabs have been written
+    std::unique_ptr<std::atomic_uint64_t[]> slab_handled_voxel_ns{};
+    uint32_t written_slab_n{};
+    // Channel k of the voxel at `p` (relative to the offset of its slab) is at `slab[k * channel_stride + p.x * strides.x + ...]`
+    GvoxStrides3D strides{};
+    size_t channel_stride{};
     size_t offset{};
 };
 
+static auto slab_voxel_n(GvoxRawUserState const &user_state) -> size_t {
+    return user_state.channels.size() * user_state.range.extent.x * user_state.range.extent.y * user_state.slab_depth;
+}
+
+// The caller must hold `slab_mtx`, or otherwise be the only one touching the slabs
+static auto get_slab_unlocked(GvoxRawUserState &user_state, uint32_t slab_i) -> uint32_t * {
+    auto &slab = user_state.slabs[slab_i];
+    if (slab == nullptr) {
+        slab = std::make_unique<uint32_t[]>(slab_voxel_n(user_state));
+    }
+    return slab.get();
+}
+
+static auto get_slab(GvoxRawUserState &user_state, uint32_t slab_i) -> uint32_t * {
+#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
+    auto lock = std::lock_guard{user_state.slab_mtx};
+#endif
+    return get_slab_unlocked(user_state, slab_i);
+}
+
+// Slabs that were never touched are written as zeros, just like untouched voxels within a slab
+static void write_slab(GvoxBlitContext *blit_ctx, GvoxRawUserState &user_state, uint32_t slab_i) {
+    auto const &range = user_state.range;
+    auto const channel_n = user_state.channels.size();
+    auto const plane_voxel_n = size_t{range.extent.x} * range.extent.y;
+    auto const z0 = size_t{slab_i} * user_state.slab_depth;
+    auto const depth = std::min(size_t{user_state.slab_depth}, range.extent.z - z0);
+    auto const *voxels = get_slab_unlocked(user_state, slab_i);
+    if (user_state.config.layout == GVOX_GVOX_RAW_SERIALIZE_ADAPTER_LAYOUT_PLANAR) {
+        // Each channel's part of the slab goes into its own plane
+        auto const voxel_n = plane_voxel_n * range.extent.z;
+        for (size_t channel_i = 0; channel_i < channel_n; ++channel_i) {
+            auto const position = user_state.offset + sizeof(uint32_t) * (channel_i * voxel_n + z0 * plane_voxel_n);
+            gvox_output_write(blit_ctx, position, sizeof(uint32_t) * plane_voxel_n * depth, voxels + channel_i * user_state.channel_stride);
+        }
+    } else {
+        auto const position = user_state.offset + sizeof(uint32_t) * z0 * plane_voxel_n * channel_n;
+        gvox_output_write(blit_ctx, position, sizeof(uint32_t) * plane_voxel_n * depth * channel_n, voxels);
+    }
+    user_state.slabs[slab_i].reset();
+}
+
+// Writes every slab that's been completely handled and directly follows the ones already written, so that the
+// output is always written in z order
+static void write_completed_slabs(GvoxBlitContext *blit_ctx, GvoxRawUserState &user_state) {
+#if GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY
+    auto lock = std::lock_guard{user_state.slab_mtx};
+#endif
+    auto const &range = user_state.range;
+    auto const plane_voxel_n = uint64_t{range.extent.x} * range.extent.y;
+    while (user_state.written_slab_n < user_state.slab_n) {
+        auto const slab_i = user_state.written_slab_n;
+        auto const z0 = uint64_t{slab_i} * user_state.slab_depth;
+        auto const depth = std::min(uint64_t{user_state.slab_depth}, range.extent.z - z0);
+        if (user_state.slab_handled_voxel_ns[slab_i].load() != plane_voxel_n * depth) {
+            break;
+        }
+        write_slab(blit_ctx, user_state, slab_i);
+        ++user_state.written_slab_n;
+    }
+}
+
 // Base
-extern "C" void gvox_serialize_adapter_gvox_raw_create(GvoxAdapterContext *ctx, void const * /*unused*/) {
+extern "C" void gvox_serialize_adapter_gvox_raw_create(GvoxAdapterContext *ctx, void const *config) {
     auto *user_state_ptr = malloc(sizeof(GvoxRawUserState));
-    [[maybe_unused]] auto &user_state = *(new (user_state_ptr) GvoxRawUserState());
+    auto &user_state = *(new (user_state_ptr) GvoxRawUserState());
     gvox_adapter_set_user_pointer(ctx, user_state_ptr);
+    if (config != nullptr) {
+        user_state.config = *static_cast<GvoxGvoxRawSerializeAdapterConfig const *>(config);
+    } else {
+        user_state.config = {
+            .layout = GVOX_GVOX_RAW_SERIALIZE_ADAPTER_LAYOUT_INTERLEAVED,
+            .streaming = 0,
+            .slab_size = BRICK_SIZE,
+        };
+    }
+    // Bricks never straddle two slabs
+    if (user_state.config.slab_size == 0) {
+        user_state.config.slab_size = BRICK_SIZE;
+    }
+    user_state.config.slab_size = (user_state.config.slab_size + BRICK_SIZE - 1) / BRICK_SIZE * BRICK_SIZE;
+    if (user_state.config.layout != GVOX_GVOX_RAW_SERIALIZE_ADAPTER_LAYOUT_INTERLEAVED && user_state.config.layout != GVOX_GVOX_RAW_SERIALIZE_ADAPTER_LAYOUT_PLANAR) {
+        gvox_adapter_push_error(ctx, GVOX_RESULT_ERROR_SERIALIZE_ADAPTER_UNREPRESENTABLE_DATA, "gvox_raw can only write interleaved or planar layouts");
+        user_state.config.layout = GVOX_GVOX_RAW_SERIALIZE_ADAPTER_LAYOUT_INTERLEAVED;
+    }
+    // A planar slab is written as one piece per plane, scattered throughout the file, which outputs that ignore
+    // the write position (like stdout) can't handle. So planar files are always written all at once in blit_end.
+    if (user_state.config.layout == GVOX_GVOX_RAW_SERIALIZE_ADAPTER_LAYOUT_PLANAR) {
+        user_state.config.streaming = 0;
+    }
 }
 
 extern "C" void gvox_serialize_adapter_gvox_raw_destroy(GvoxAdapterContext *ctx) {
@@ -31,13 +137,19 @@ extern "C" void gvox_serialize_adapter_gvox_raw_blit_begin(GvoxBlitContext *blit
     auto &user_state = *static_cast<GvoxRawUserState *>(gvox_adapter_get_user_pointer(ctx));
     user_state.offset = 0;
     user_state.range = *range;
-    auto magic = std::bit_cast<uint32_t>(std::array<char, 4>{'g', 'v', 'r', '\0'});
+    auto const is_planar = user_state.config.layout == GVOX_GVOX_RAW_SERIALIZE_ADAPTER_LAYOUT_PLANAR;
+    auto const magic = is_planar ? GVOX_RAW_MAGIC_V2 : GVOX_RAW_MAGIC_V1;
     gvox_output_write(blit_ctx, user_state.offset, sizeof(uint32_t), &magic);
     user_state.offset += sizeof(magic);
     gvox_output_write(blit_ctx, user_state.offset, sizeof(*range), range);
     user_state.offset += sizeof(*range);
     gvox_output_write(blit_ctx, user_state.offset, sizeof(channel_flags), &channel_flags);
     user_state.offset += sizeof(channel_flags);
+    if (is_planar) {
+        auto const layout_flags = GVOX_RAW_LAYOUT_FLAG_PLANAR;
+        gvox_output_write(blit_ctx, user_state.offset, sizeof(layout_flags), &layout_flags);
+        user_state.offset += sizeof(layout_flags);
+    }
     user_state.channels.resize(static_cast<size_t>(std::popcount(channel_flags)));
     uint32_t next_channel = 0;
     for (uint8_t channel_i = 0; channel_i < 32; ++channel_i) {
@@ -46,72 +158,167 @@ extern "C" void gvox_serialize_adapter_gvox_raw_blit_begin(GvoxBlitContext *blit
             ++next_channel;
         }
     }
-    user_state.voxels.resize(user_state.channels.size() * range->extent.x * range->extent.y * range->extent.z);
+    auto const channel_n = user_state.channels.size();
+    user_state.slab_depth = std::max(user_state.config.streaming != 0 ? std::min(user_state.config.slab_size, range->extent.z) : range->extent.z, 1u);
+    user_state.slab_n = (range->extent.z + user_state.slab_depth - 1) / user_state.slab_depth;
+    user_state.slabs.clear();
+    user_state.slabs.resize(user_state.slab_n);
+    user_state.slab_handled_voxel_ns = std::make_unique<std::atomic_uint64_t[]>(user_state.slab_n);
+    user_state.written_slab_n = 0;
+    auto const voxel_stride = is_planar ? size_t{1} : channel_n;
+    user_state.strides = {
+        .x = voxel_stride,
+        .y = voxel_stride * range->extent.x,
+        .z = voxel_stride * range->extent.x * range->extent.y,
+    };
+    user_state.channel_stride = is_planar ? size_t{range->extent.x} * range->extent.y * user_state.slab_depth : size_t{1};
 }
 
 extern "C" void gvox_serialize_adapter_gvox_raw_blit_end(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx) {
     auto &user_state = *static_cast<GvoxRawUserState *>(gvox_adapter_get_user_pointer(ctx));
-    gvox_output_write(blit_ctx, user_state.offset, user_state.voxels.size() * sizeof(user_state.voxels[0]), user_state.voxels.data());
+    // Whatever wasn't written as the blit went (all of it, unless streaming a serialize driven blit)
+    for (auto slab_i = user_state.written_slab_n; slab_i < user_state.slab_n; ++slab_i) {
+        write_slab(blit_ctx, user_state, slab_i);
+    }
+    user_state.written_slab_n = user_state.slab_n;
+    user_state.slabs.clear();
 }
 
-static void handle_region(GvoxRawUserState &user_state, GvoxRegionRange const *range, auto user_func) {
-    for (uint32_t zi = 0; zi < range->extent.z; ++zi) {
-        for (uint32_t yi = 0; yi < range->extent.y; ++yi) {
-            for (uint32_t xi = 0; xi < range->extent.x; ++xi) {
-                auto const pos = GvoxOffset3D{
-                    static_cast<int32_t>(xi) + range->offset.x,
-                    static_cast<int32_t>(yi) + range->offset.y,
-                    static_cast<int32_t>(zi) + range->offset.z,
-                };
-                if (pos.x < user_state.range.offset.x ||
-                    pos.y < user_state.range.offset.y ||
-                    pos.z < user_state.range.offset.z ||
-                    pos.x >= user_state.range.offset.x + static_cast<int32_t>(user_state.range.extent.x) ||
-                    pos.y >= user_state.range.offset.y + static_cast<int32_t>(user_state.range.extent.y) ||
-                    pos.z >= user_state.range.offset.z + static_cast<int32_t>(user_state.range.extent.z)) {
-                    continue;
-                }
-                auto output_rel_x = static_cast<size_t>(pos.x - user_state.range.offset.x);
-                auto output_rel_y = static_cast<size_t>(pos.y - user_state.range.offset.y);
-                auto output_rel_z = static_cast<size_t>(pos.z - user_state.range.offset.z);
-                for (uint32_t channel_i = 0; channel_i < user_state.channels.size(); ++channel_i) {
-                    auto output_index = static_cast<size_t>(output_rel_x + output_rel_y * user_state.range.extent.x + output_rel_z * user_state.range.extent.x * user_state.range.extent.y) * user_state.channels.size() + channel_i;
-                    user_func(channel_i, output_index, pos);
+// General
+extern "C" auto gvox_serialize_adapter_gvox_raw_query_details() -> GvoxSerializeAdapterDetails {
+    return {
+        .supports_concurrent_serialization = 1,
+    };
+}
+
+// Serialize Driven
+static void fill_uniform_brick(GvoxRawUserState const &user_state, uint32_t *voxels, GvoxExtent3D const &extent, std::vector<GvoxSample> const &samples) {
+    auto const &strides = user_state.strides;
+    for (size_t channel_i = 0; channel_i < samples.size(); ++channel_i) {
+        if (samples[channel_i].is_present == 0u) {
+            continue;
+        }
+        for (uint32_t zi = 0; zi < extent.z; ++zi) {
+            for (uint32_t yi = 0; yi < extent.y; ++yi) {
+                auto *row = voxels + channel_i * user_state.channel_stride + yi * strides.y + zi * strides.z;
+                for (uint32_t xi = 0; xi < extent.x; ++xi) {
+                    row[xi * strides.x] = samples[channel_i].data;
                 }
             }
         }
     }
 }
 
-// Serialize Driven
 extern "C" void gvox_serialize_adapter_gvox_raw_serialize_region(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegionRange const *range, uint32_t /* channel_flags */) {
     auto &user_state = *static_cast<GvoxRawUserState *>(gvox_adapter_get_user_pointer(ctx));
-    handle_region(
-        user_state, range,
-        [blit_ctx, &user_state](uint32_t channel_i, size_t output_index, GvoxOffset3D const &pos) {
-            auto const sample_range = GvoxRegionRange{
-                .offset = pos,
-                .extent = GvoxExtent3D{1, 1, 1},
-            };
-            auto region = gvox_load_region_range(blit_ctx, &sample_range, 1u << user_state.channels[channel_i]);
-            auto sample = gvox_sample_region(blit_ctx, &region, &pos, user_state.channels[channel_i]);
-            if (sample.is_present == 0u) {
-                sample.data = 0u;
+    auto const &out_range = user_state.range;
+    auto const x0 = std::max(range->offset.x, out_range.offset.x);
+    auto const y0 = std::max(range->offset.y, out_range.offset.y);
+    auto const z0 = std::max(range->offset.z, out_range.offset.z);
+    auto const x1 = std::min(range->offset.x + static_cast<int32_t>(range->extent.x), out_range.offset.x + static_cast<int32_t>(out_range.extent.x));
+    auto const y1 = std::min(range->offset.y + static_cast<int32_t>(range->extent.y), out_range.offset.y + static_cast<int32_t>(out_range.extent.y));
+    auto const z1 = std::min(range->offset.z + static_cast<int32_t>(range->extent.z), out_range.offset.z + static_cast<int32_t>(out_range.extent.z));
+    if (x0 >= x1 || y0 >= y1 || z0 >= z1) {
+        return;
+    }
+    auto const channel_n = user_state.channels.size();
+    auto channel_flags = uint32_t{0};
+    for (auto channel_id : user_state.channels) {
+        channel_flags |= 1u << channel_id;
+    }
+    // Each channel is loaded straight into place in the output, whichever the layout
+    auto const &strides = user_state.strides;
+    auto uniform_samples = std::vector<GvoxSample>(channel_n);
+    // Bricks are aligned to the output range, so that they line up with the source's own bricks when
+    // converting between formats that store the same range
+    auto const brick_begin = [&](int32_t v, int32_t out_offset) {
+        return out_offset + (v - out_offset) / static_cast<int32_t>(BRICK_SIZE) * static_cast<int32_t>(BRICK_SIZE);
+    };
+    for (int32_t bz = brick_begin(z0, out_range.offset.z); bz < z1; bz += static_cast<int32_t>(BRICK_SIZE)) {
+        for (int32_t by = brick_begin(y0, out_range.offset.y); by < y1; by += static_cast<int32_t>(BRICK_SIZE)) {
+            for (int32_t bx = brick_begin(x0, out_range.offset.x); bx < x1; bx += static_cast<int32_t>(BRICK_SIZE)) {
+                auto const bx0 = std::max(bx, x0);
+                auto const by0 = std::max(by, y0);
+                auto const bz0 = std::max(bz, z0);
+                auto const brick_range = GvoxRegionRange{
+                    .offset = {bx0, by0, bz0},
+                    .extent = {
+                        static_cast<uint32_t>(std::min(bx + static_cast<int32_t>(BRICK_SIZE), x1) - bx0),
+                        static_cast<uint32_t>(std::min(by + static_cast<int32_t>(BRICK_SIZE), y1) - by0),
+                        static_cast<uint32_t>(std::min(bz + static_cast<int32_t>(BRICK_SIZE), z1) - bz0),
+                    },
+                };
+                auto const slab_i = static_cast<uint32_t>(bz0 - out_range.offset.z) / user_state.slab_depth;
+                auto const slab_z = static_cast<uint32_t>(bz0 - out_range.offset.z) % user_state.slab_depth;
+                auto const base_index = static_cast<size_t>(bx0 - out_range.offset.x) * strides.x + static_cast<size_t>(by0 - out_range.offset.y) * strides.y + slab_z * strides.z;
+                auto *brick_voxels = get_slab(user_state, slab_i) + base_index;
+                if ((gvox_query_region_flags(blit_ctx, &brick_range, channel_flags) & GVOX_REGION_FLAG_UNIFORM) != 0) {
+                    auto const sample_range = GvoxRegionRange{.offset = brick_range.offset, .extent = {1, 1, 1}};
+                    auto region = gvox_load_region_range(blit_ctx, &sample_range, channel_flags);
+                    gvox_sample_region_channels(blit_ctx, &region, &sample_range.offset, uniform_samples.data(), 1, channel_flags);
+                    gvox_unload_region_range(blit_ctx, &region, &sample_range);
+                    fill_uniform_brick(user_state, brick_voxels, brick_range.extent, uniform_samples);
+                    continue;
+                }
+                for (uint32_t channel_i = 0; channel_i < channel_n; ++channel_i) {
+                    gvox_load_region_dense(blit_ctx, &brick_range, user_state.channels[channel_i], brick_voxels + channel_i * user_state.channel_stride, &strides);
+                }
             }
-            user_state.voxels[output_index] = sample.data;
-            gvox_unload_region_range(blit_ctx, &region, &sample_range);
-        });
+        }
+        // Serialize driven blits handle every voxel exactly once, so a slab is done once all its voxels have been.
+        // Parse driven ones make no such promise, so they're all written in blit_end.
+        if (user_state.config.streaming != 0) {
+            auto const bz0 = std::max(bz, z0);
+            auto const bz1 = std::min(bz + static_cast<int32_t>(BRICK_SIZE), z1);
+            auto const slab_i = static_cast<uint32_t>(bz0 - out_range.offset.z) / user_state.slab_depth;
+            user_state.slab_handled_voxel_ns[slab_i].fetch_add(static_cast<uint64_t>(x1 - x0) * static_cast<uint64_t>(y1 - y0) * static_cast<uint64_t>(bz1 - bz0));
+            write_completed_slabs(blit_ctx, user_state);
+        }
+    }
 }
 
 // Parse Driven
 extern "C" void gvox_serialize_adapter_gvox_raw_receive_region(GvoxBlitContext *blit_ctx, GvoxAdapterContext *ctx, GvoxRegion const *region) {
     auto &user_state = *static_cast<GvoxRawUserState *>(gvox_adapter_get_user_pointer(ctx));
-    handle_region(
-        user_state, &region->range,
-        [blit_ctx, region, &user_state](uint32_t channel_i, size_t output_index, GvoxOffset3D const &pos) {
-            auto sample = gvox_sample_region(blit_ctx, region, &pos, user_state.channels[channel_i]);
-            if (sample.is_present != 0u) {
-                user_state.voxels[output_index] = sample.data;
+    auto const &range = region->range;
+    auto const &out_range = user_state.range;
+    auto const x0 = std::max(range.offset.x, out_range.offset.x);
+    auto const y0 = std::max(range.offset.y, out_range.offset.y);
+    auto const z0 = std::max(range.offset.z, out_range.offset.z);
+    auto const x1 = std::min(range.offset.x + static_cast<int32_t>(range.extent.x), out_range.offset.x + static_cast<int32_t>(out_range.extent.x));
+    auto const y1 = std::min(range.offset.y + static_cast<int32_t>(range.extent.y), out_range.offset.y + static_cast<int32_t>(out_range.extent.y));
+    auto const z1 = std::min(range.offset.z + static_cast<int32_t>(range.extent.z), out_range.offset.z + static_cast<int32_t>(out_range.extent.z));
+    if (x0 >= x1 || y0 >= y1 || z0 >= z1) {
+        return;
+    }
+    auto const row_n = static_cast<uint32_t>(x1 - x0);
+    auto const channel_n = user_state.channels.size();
+    auto channel_flags = uint32_t{0};
+    for (auto channel_id : user_state.channels) {
+        channel_flags |= 1u << channel_id;
+    }
+    auto offsets = std::vector<GvoxOffset3D>(row_n);
+    // Every channel of a row is sampled in one call, interleaved, and then scattered into the output's layout
+    auto samples = std::vector<GvoxSample>(row_n * channel_n);
+    auto const &strides = user_state.strides;
+    for (int32_t z = z0; z < z1; ++z) {
+        auto const slab_i = static_cast<uint32_t>(z - out_range.offset.z) / user_state.slab_depth;
+        auto const slab_z = static_cast<uint32_t>(z - out_range.offset.z) % user_state.slab_depth;
+        auto *slab_voxels = get_slab(user_state, slab_i);
+        for (int32_t y = y0; y < y1; ++y) {
+            for (uint32_t xi = 0; xi < row_n; ++xi) {
+                offsets[xi] = {x0 + static_cast<int32_t>(xi), y, z};
+            }
+            auto const row_index = static_cast<size_t>(x0 - out_range.offset.x) * strides.x + static_cast<size_t>(y - out_range.offset.y) * strides.y + slab_z * strides.z;
+            gvox_sample_region_channels(blit_ctx, region, offsets.data(), samples.data(), row_n, channel_flags);
+            for (uint32_t xi = 0; xi < row_n; ++xi) {
+                for (size_t channel_i = 0; channel_i < channel_n; ++channel_i) {
+                    auto const &sample = samples[xi * channel_n + channel_i];
+                    if (sample.is_present != 0u) {
+                        slab_voxels[row_index + xi * strides.x + channel_i * user_state.channel_stride] = sample.data;
+                    }
+                }
             }
-        });
+        }
+    }
 }
@@ -1,8 +1,12 @@
 #pragma once
 
 #include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
 
-static constexpr auto REGION_SIZE = size_t{8};
 
 static constexpr auto ceil_log2(uint32_t x) -> uint32_t {
     constexpr auto const t = std::array<uint32_t, 5>{
@@ -29,25 +33,127 @@ static constexpr auto get_mask(uint32_t bits_per_variant) -> uint32_t {
     return (~0u) >> (32 - bits_per_variant);
 }
 
-static constexpr auto calc_palette_region_size(size_t bits_per_variant) -> size_t {
-    auto palette_region_size = (bits_per_variant * REGION_SIZE * REGION_SIZE * REGION_SIZE + 7) / 8;
+// Bricks (regions) are REGION_SIZE^3 voxels, where REGION_SIZE is one of these. Versions 1 and 2 of the format
+// always use DEFAULT_REGION_SIZE, version 3 stores it in the header.
+static constexpr auto DEFAULT_REGION_SIZE = size_t{8};
+static constexpr auto is_valid_region_size(size_t region_size) -> bool {
+    return region_size == 8 || region_size == 16 || region_size == 32;
+}
+
+static constexpr auto calc_palette_region_size(size_t region_size, size_t bits_per_variant) -> size_t {
+    auto palette_region_size = (bits_per_variant * region_size * region_size * region_size + 7) / 8;
     palette_region_size = (palette_region_size + 3) / 4;
     auto size = palette_region_size + 1;
     return size * 4;
 }
 
-static constexpr auto calc_block_size(size_t variant_n) -> size_t {
-    return calc_palette_region_size(ceil_log2(static_cast<uint32_t>(variant_n))) + sizeof(uint32_t) * variant_n;
+static constexpr auto calc_block_size(size_t region_size, size_t variant_n) -> size_t {
+    return calc_palette_region_size(region_size, ceil_log2(static_cast<uint32_t>(variant_n))) + sizeof(uint32_t) * variant_n;
+}
+
+static constexpr auto calc_max_region_allocation_size(size_t region_size) -> size_t {
+    return region_size * region_size * region_size * sizeof(uint32_t);
 }
 
-static constexpr auto MAX_REGION_ALLOCATION_SIZE = REGION_SIZE * REGION_SIZE * REGION_SIZE * sizeof(uint32_t);
-static constexpr auto MAX_REGION_COMPRESSED_VARIANT_N =
-    REGION_SIZE == 8 ? 367 : (REGION_SIZE == 16 ? 2559 : 0);
+// The most variants a brick can have while its palette is still smaller than the raw voxels
+static constexpr auto calc_max_region_compressed_variant_n(size_t region_size) -> size_t {
+    auto variant_n = size_t{1};
+    while (calc_block_size(region_size, variant_n + 1) <= calc_max_region_allocation_size(region_size)) {
+        ++variant_n;
+    }
+    return variant_n;
+}
+
+template <size_t REGION_SIZE>
+static constexpr auto MAX_REGION_ALLOCATION_SIZE = calc_max_region_allocation_size(REGION_SIZE);
+template <size_t REGION_SIZE>
+static constexpr auto MAX_REGION_COMPRESSED_VARIANT_N = calc_max_region_compressed_variant_n(REGION_SIZE);
+template <size_t REGION_SIZE>
+static constexpr auto MAX_BITS_PER_VARIANT = ceil_log2(static_cast<uint32_t>(MAX_REGION_COMPRESSED_VARIANT_N<REGION_SIZE>));
+
+static_assert(MAX_REGION_COMPRESSED_VARIANT_N<8> == 367);
+static_assert(MAX_REGION_COMPRESSED_VARIANT_N<16> == 2559);
+static_assert(MAX_REGION_COMPRESSED_VARIANT_N<32> == 17407);
+
+// Calls `fn` with the region size as a std::integral_constant, so that whatever it runs is compiled separately
+// for each size, with the size known in its inner loops
+template <typename Fn>
+static constexpr auto dispatch_region_size(size_t region_size, Fn &&fn) -> decltype(auto) {
+    switch (region_size) {
+    case 16: return fn(std::integral_constant<size_t, 16>{});
+    case 32: return fn(std::integral_constant<size_t, 32>{});
+    default: return fn(std::integral_constant<size_t, 8>{});
+    }
+}
+
+static constexpr auto get_max_region_compressed_variant_n(size_t region_size) -> size_t {
+    return dispatch_region_size(region_size, [](auto region_size_c) {
+        return MAX_REGION_COMPRESSED_VARIANT_N<decltype(region_size_c)::value>;
+    });
+}
+
+template <size_t REGION_SIZE>
+static constexpr auto BRICK_VOXEL_N = REGION_SIZE * REGION_SIZE * REGION_SIZE;
+
+// Scratch space for handling one brick. 8^3 bricks keep theirs on the stack, but bigger ones would need up to a
+// few MiB of it, so theirs goes on the heap. Either way it's default-initialized rather than zeroed, so nothing
+// may be read from it that hasn't been written first.
+template <size_t REGION_SIZE, typename T>
+struct BrickScratch {
+    static constexpr auto IS_ON_STACK = REGION_SIZE <= 8;
 
-static_assert(calc_block_size(MAX_REGION_COMPRESSED_VARIANT_N) <= MAX_REGION_ALLOCATION_SIZE);
-static_assert(calc_block_size(MAX_REGION_COMPRESSED_VARIANT_N + 1) > MAX_REGION_ALLOCATION_SIZE);
+    std::conditional_t<IS_ON_STACK, T, std::unique_ptr<T>> storage;
+
+    BrickScratch() {
+        if constexpr (!IS_ON_STACK) {
+            storage = std::make_unique_for_overwrite<T>();
+        }
+    }
+
+    auto operator*() -> T & {
+        if constexpr (IS_ON_STACK) {
+            return storage;
+        } else {
+            return *storage;
+        }
+    }
+    auto operator->() -> T * { return &**this; }
+};
 
 struct ChannelHeader {
     uint32_t variant_n;
     uint32_t blob_offset; // if variant_n == 1, this is just the data
 };
+
+// Version 2 widens the blob offsets to 64 bits and lays the blobs out in Morton order of their bricks, so that
+// bricks that are close together in space are close together in the file (when streamed, Morton order within
+// each z slab of bricks, one slab after the other). The header table stays in plain x-major brick order, which
+// means the header of any brick can be found without reading the others.
+static constexpr auto GVOX_PALETTE_MAGIC_V1 = std::bit_cast<uint32_t>(std::array<char, 4>{'g', 'v', 'p', '\0'});
+static constexpr auto GVOX_PALETTE_MAGIC_V2 = std::bit_cast<uint32_t>(std::array<char, 4>{'g', 'v', 'p', '2'});
+// Version 3 is version 2 with a uint32_t region size following the channel count
+static constexpr auto GVOX_PALETTE_MAGIC_V3 = std::bit_cast<uint32_t>(std::array<char, 4>{'g', 'v', 'p', '3'});
+
+struct ChannelHeaderV2 {
+    uint32_t variant_n;
+    uint32_t compressed_size; // if not 0, the blob is LZ compressed (see lz.hpp) and this is its size in the file
+    uint64_t blob_offset;     // if variant_n == 1, this is just the data
+};
+
+static constexpr auto morton_spread_bits(uint64_t x) -> uint64_t {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffff;
+    x = (x | x << 16) & 0x1f0000ff0000ff;
+    x = (x | x << 8) & 0x100f00f00f00f00f;
+    x = (x | x << 4) & 0x10c30c30c30c30c3;
+    x = (x | x << 2) & 0x1249249249249249;
+    return x;
+}
+
+static constexpr auto morton_encode(uint32_t x, uint32_t y, uint32_t z) -> uint64_t {
+    return morton_spread_bits(x) | (morton_spread_bits(y) << 1) | (morton_spread_bits(z) << 2);
+}
+
+static_assert(morton_encode(1, 1, 1) == 0b111);
+static_assert(morton_encode(2, 0, 3) == 0b101'100);
+static_assert(morton_encode(0x1fffff, 0, 0) == 0x1249249249249249);
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+
+// Version 2 follows the channel flags with a field of layout flags. Interleaved files are still written as
+// version 1, so that older versions of gvox keep reading them.
+static constexpr auto GVOX_RAW_MAGIC_V1 = std::bit_cast<uint32_t>(std::array<char, 4>{'g', 'v', 'r', '\0'});
+static constexpr auto GVOX_RAW_MAGIC_V2 = std::bit_cast<uint32_t>(std::array<char, 4>{'g', 'v', 'r', '2'});
+
+// Every channel is stored in a contiguous plane of its own, one after the other in channel order, instead of the
+// channels of each voxel being stored next to each other
+static constexpr auto GVOX_RAW_LAYOUT_FLAG_PLANAR = uint32_t{0x00000001};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <array>
+
+// A small byte-oriented LZ77 codec, in the spirit of LZ4. The output is a list of sequences, each made of
+// a token byte (literal count in the high nibble, match length - MIN_MATCH in the low one, where 15 means
+// more length bytes follow, each adding up to 255), the literals, and a 16-bit little endian match offset.
+// The last sequence has no match. Overlapping matches are allowed, so runs of a repeated pattern compress
+// down to a handful of bytes.
+namespace gvox_detail::lz {
+    static constexpr auto MIN_MATCH = size_t{4};
+    static constexpr auto MAX_OFFSET = size_t{0xffff};
+    static constexpr auto HASH_BITS = uint32_t{10};
+
+    static inline auto read_u32(uint8_t const *ptr) -> uint32_t {
+        auto result = uint32_t{};
+        std::memcpy(&result, ptr, sizeof(result));
+        return result;
+    }
+
+    static inline auto hash_u32(uint32_t value) -> uint32_t {
+        return (value * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    // Writes `length` as the continuation bytes of a nibble that was saturated at 15
+    static inline auto write_length(uint8_t *&dst, uint8_t const *dst_end, size_t length) -> bool {
+        for (; length >= 255; length -= 255) {
+            if (dst == dst_end) {
+                return false;
+            }
+            *dst++ = 255;
+        }
+        if (dst == dst_end) {
+            return false;
+        }
+        *dst++ = static_cast<uint8_t>(length);
+        return true;
+    }
+
+    static inline auto read_length(uint8_t const *&src, uint8_t const *src_end, size_t &length) -> bool {
+        auto byte = uint8_t{255};
+        while (byte == 255) {
+            if (src == src_end) {
+                return false;
+            }
+            byte = *src++;
+            length += byte;
+        }
+        return true;
+    }
+
+    static inline auto write_sequence(uint8_t *&dst, uint8_t const *dst_end, uint8_t const *literals, size_t literal_n, size_t match_length, size_t offset) -> bool {
+        if (dst == dst_end) {
+            return false;
+        }
+        auto const has_match = match_length != 0;
+        auto const match_code = has_match ? match_length - MIN_MATCH : 0;
+        *dst++ = static_cast<uint8_t>((std::min<size_t>(literal_n, 15) << 4) | std::min<size_t>(match_code, 15));
+        if (literal_n >= 15 && !write_length(dst, dst_end, literal_n - 15)) {
+            return false;
+        }
+        if (static_cast<size_t>(dst_end - dst) < literal_n) {
+            return false;
+        }
+        std::memcpy(dst, literals, literal_n);
+        dst += literal_n;
+        if (!has_match) {
+            return true;
+        }
+        if (dst_end - dst < 2) {
+            return false;
+        }
+        *dst++ = static_cast<uint8_t>(offset);
+        *dst++ = static_cast<uint8_t>(offset >> 8);
+        return match_code < 15 || write_length(dst, dst_end, match_code - 15);
+    }
+
+    // Returns the compressed size, or 0 if the output didn't fit into `dst_capacity` bytes
+    static inline auto compress(uint8_t const *src, size_t src_size, uint8_t *dst, size_t dst_capacity) -> size_t {
+        auto table = std::array<uint32_t, size_t{1} << HASH_BITS>{};
+        auto *dst_ptr = dst;
+        auto const *dst_end = dst + dst_capacity;
+        auto literal_begin = size_t{0};
+        auto i = size_t{0};
+        while (i + MIN_MATCH <= src_size) {
+            auto const value = read_u32(src + i);
+            auto const hash = hash_u32(value);
+            // Positions are stored + 1, so that 0 can mean empty
+            auto const candidate = static_cast<size_t>(table[hash]);
+            table[hash] = static_cast<uint32_t>(i + 1);
+            if (candidate == 0 || i - (candidate - 1) > MAX_OFFSET || read_u32(src + candidate - 1) != value) {
+                ++i;
+                continue;
+            }
+            auto const match_begin = candidate - 1;
+            auto match_length = MIN_MATCH;
+            while (i + match_length < src_size && src[match_begin + match_length] == src[i + match_length]) {
+                ++match_length;
+            }
+            if (!write_sequence(dst_ptr, dst_end, src + literal_begin, i - literal_begin, match_length, i - match_begin)) {
+                return 0;
+            }
+            i += match_length;
+            literal_begin = i;
+        }
+        if (!write_sequence(dst_ptr, dst_end, src + literal_begin, src_size - literal_begin, 0, 0)) {
+            return 0;
+        }
+        return static_cast<size_t>(dst_ptr - dst);
+    }
+
+    // Returns false if the input is malformed or doesn't decompress to exactly `dst_size` bytes
+    static inline auto decompress(uint8_t const *src, size_t src_size, uint8_t *dst, size_t dst_size) -> bool {
+        auto const *src_end = src + src_size;
+        auto *dst_ptr = dst;
+        auto const *dst_end = dst + dst_size;
+        while (src != src_end) {
+            auto const token = *src++;
+            auto literal_n = static_cast<size_t>(token >> 4);
+            if (literal_n == 15 && !read_length(src, src_end, literal_n)) {
+                return false;
+            }
+            if (static_cast<size_t>(src_end - src) < literal_n || static_cast<size_t>(dst_end - dst_ptr) < literal_n) {
+                return false;
+            }
+            std::memcpy(dst_ptr, src, literal_n);
+            src += literal_n;
+            dst_ptr += literal_n;
+            if (src == src_end) {
+                break;
+            }
+            if (src_end - src < 2) {
+                return false;
+            }
+            auto const offset = static_cast<size_t>(src[0]) | (static_cast<size_t>(src[1]) << 8);
+            src += 2;
+            auto match_length = static_cast<size_t>(token & 0xf);
+            if (match_length == 15 && !read_length(src, src_end, match_length)) {
+                return false;
+            }
+            match_length += MIN_MATCH;
+            if (offset == 0 || offset > static_cast<size_t>(dst_ptr - dst) || static_cast<size_t>(dst_end - dst_ptr) < match_length) {
+                return false;
+            }
+            // Byte by byte, since the match may overlap what it's writing
+            auto const *match = dst_ptr - offset;
+            for (size_t i = 0; i < match_length; ++i) {
+                dst_ptr[i] = match[i];
+            }
+            dst_ptr += match_length;
+        }
+        return dst_ptr == dst_end;
+    }
+} // namespace gvox_detail::lz
@@ -1,90 +1,409 @@
 #pragma once
 
-#include <functional>
+#include <gvox/gvox.h>
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <algorithm>
+#include <type_traits>
+#include <new>
 
 #define ENABLE_THREAD_POOL (GVOX_ENABLE_MULTITHREADED_ADAPTERS && GVOX_ENABLE_THREADSAFETY)
 
 #if ENABLE_THREAD_POOL
+#include <bit>
+#include <atomic>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <queue>
+#include <deque>
+#include <memory>
+#include <vector>
 #endif
 
 namespace gvox_detail::thread_pool {
-    struct ThreadPool {
-        void start() {
+    struct TaskGroup;
+
+    // A type-erased callable that never allocates. Whatever it wraps is copied bitwise into the job itself,
+    // so it has to be small and trivially copyable (in practice, a lambda capturing pointers and indices).
+    struct Job {
+        static constexpr auto CAPTURE_SIZE = size_t{48};
+
+        void (*invoke)(Job const &self) = nullptr;
+        TaskGroup *group = nullptr;
+        alignas(void *) std::array<std::byte, CAPTURE_SIZE> captures{};
+
+        template <typename F>
+        static auto make(F const &f, TaskGroup *group) -> Job {
+            static_assert(sizeof(F) <= CAPTURE_SIZE && alignof(F) <= alignof(void *), "Job captures are too large");
+            static_assert(std::is_trivially_copyable_v<F> && std::is_trivially_destructible_v<F>, "Job captures must be trivially copyable");
+            auto result = Job{};
+            result.invoke = [](Job const &self) {
+                (*std::launder(reinterpret_cast<F const *>(self.captures.data())))();
+            };
+            result.group = group;
+            new (result.captures.data()) F(f);
+            return result;
+        }
+    };
+
 #if ENABLE_THREAD_POOL
-            uint32_t const num_threads = std::thread::hardware_concurrency();
-            threads.resize(num_threads);
-            for (uint32_t i = 0; i < num_threads; i++) {
-                threads.at(i) = std::thread(&ThreadPool::thread_loop, this);
+    static constexpr auto JOB_WORD_N = sizeof(Job) / sizeof(uint64_t);
+    static_assert(sizeof(Job) == JOB_WORD_N * sizeof(uint64_t) && std::is_trivially_copyable_v<Job>);
+
+    // Chase-Lev work-stealing deque (Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models").
+    // Only the owning worker pushes and pops at the bottom, anyone may steal from the top.
+    struct JobDeque {
+        JobDeque() {
+            buffers.push_back(std::make_unique<Buffer>(INITIAL_CAPACITY));
+            buffer.store(buffers.back().get(), std::memory_order_relaxed);
+        }
+
+        void push(Job const &job) {
+            auto const b = bottom.load(std::memory_order_relaxed);
+            auto const t = top.load(std::memory_order_acquire);
+            auto *a = buffer.load(std::memory_order_relaxed);
+            if (b - t > a->capacity - 1) {
+                a = grow(a, t, b);
+            }
+            a->put(b, job);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        auto pop(Job &job) -> bool {
+            auto const b = bottom.load(std::memory_order_relaxed) - 1;
+            auto *a = buffer.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto t = top.load(std::memory_order_relaxed);
+            if (t > b) {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
+            job = a->get(b);
+            if (t == b) {
+                // Last job, race the thieves for it
+                auto const won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return won;
+            }
+            return true;
+        }
+        auto steal(Job &job) -> bool {
+            auto t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto const b = bottom.load(std::memory_order_acquire);
+            if (t >= b) {
+                return false;
+            }
+            auto const *a = buffer.load(std::memory_order_acquire);
+            auto const stolen = a->get(t);
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return false;
+            }
+            job = stolen;
+            return true;
+        }
+
+      private:
+        static constexpr auto INITIAL_CAPACITY = int64_t{256};
+
+        // Jobs are stored as atomic words, since a thief may read a slot while the owner overwrites it.
+        // The thief then loses the CAS on `top` and throws away what it read.
+        struct Buffer {
+            int64_t capacity;
+            std::vector<std::array<std::atomic_uint64_t, JOB_WORD_N>> slots;
+
+            explicit Buffer(int64_t a_capacity) : capacity{a_capacity}, slots(static_cast<size_t>(a_capacity)) {}
+
+            void put(int64_t i, Job const &job) {
+                auto const words = std::bit_cast<std::array<uint64_t, JOB_WORD_N>>(job);
+                auto &slot = slots[static_cast<size_t>(i & (capacity - 1))];
+                for (size_t word_i = 0; word_i < JOB_WORD_N; ++word_i) {
+                    slot[word_i].store(words[word_i], std::memory_order_relaxed);
+                }
             }
+            [[nodiscard]] auto get(int64_t i) const -> Job {
+                auto words = std::array<uint64_t, JOB_WORD_N>{};
+                auto const &slot = slots[static_cast<size_t>(i & (capacity - 1))];
+                for (size_t word_i = 0; word_i < JOB_WORD_N; ++word_i) {
+                    words[word_i] = slot[word_i].load(std::memory_order_relaxed);
+                }
+                return std::bit_cast<Job>(words);
+            }
+        };
+
+        auto grow(Buffer *a, int64_t t, int64_t b) -> Buffer * {
+            // Thieves may still be reading the old buffer, so it's kept alive until the deque is destroyed
+            buffers.push_back(std::make_unique<Buffer>(a->capacity * 2));
+            auto *result = buffers.back().get();
+            for (auto i = t; i < b; ++i) {
+                result->put(i, a->get(i));
+            }
+            buffer.store(result, std::memory_order_release);
+            return result;
+        }
+
+        alignas(64) std::atomic_int64_t top{0};
+        alignas(64) std::atomic_int64_t bottom{0};
+        std::atomic<Buffer *> buffer{};
+        std::vector<std::unique_ptr<Buffer>> buffers{};
+    };
 #endif
+
+    struct ThreadPool {
+        ThreadPool() = default;
+        ThreadPool(ThreadPool const &) = delete;
+        ThreadPool(ThreadPool &&) = delete;
+        auto operator=(ThreadPool const &) -> ThreadPool & = delete;
+        auto operator=(ThreadPool &&) -> ThreadPool & = delete;
+        ~ThreadPool() {
+            stop();
         }
-        void enqueue(std::function<void()> const &job) {
+
+        // Does nothing if the pool is already running. A thread count of 0 means one per hardware thread
+        void start(uint32_t num_threads = 0) {
 #if ENABLE_THREAD_POOL
-            {
-                std::unique_lock<std::mutex> lock(queue_mutex);
-                jobs.push(job);
+            if (!workers.empty()) {
+                return;
+            }
+            if (num_threads == 0) {
+                num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+            }
+            should_terminate = false;
+            workers.resize(num_threads);
+            for (auto &worker : workers) {
+                worker = std::make_unique<Worker>();
+            }
+            for (uint32_t i = 0; i < num_threads; i++) {
+                workers[i]->thread = std::thread(&ThreadPool::thread_loop, this, i);
             }
-            mutex_condition.notify_one();
 #else
-            job();
+            (void)num_threads;
 #endif
         }
+        // Must only be called once every job has finished
         void stop() {
 #if ENABLE_THREAD_POOL
             {
-                std::unique_lock<std::mutex> lock(queue_mutex);
+                std::unique_lock<std::mutex> lock(sleep_mutex);
                 should_terminate = true;
             }
-            mutex_condition.notify_all();
-            for (std::thread &active_thread : threads) {
-                active_thread.join();
+            sleep_condition.notify_all();
+            for (auto &worker : workers) {
+                worker->thread.join();
             }
-            threads.clear();
+            workers.clear();
 #endif
         }
-        auto busy() -> bool {
+        [[nodiscard]] auto thread_count() const -> uint32_t {
 #if ENABLE_THREAD_POOL
-            bool pool_busy;
-            {
-                std::unique_lock<std::mutex> lock(queue_mutex);
-                pool_busy = !jobs.empty();
+            return static_cast<uint32_t>(workers.size());
+#else
+            return 0;
+#endif
+        }
+
+        // Workers push onto their own deque, any other thread goes through the shared injection queue
+        void submit(Job const &job) {
+#if ENABLE_THREAD_POOL
+            if (current_pool == this) {
+                workers[current_worker_index]->deque.push(job);
+            } else {
+                std::unique_lock<std::mutex> lock(injection_mutex);
+                injected_jobs.push_back(job);
+            }
+            work_epoch.fetch_add(1);
+            if (sleeper_n.load() != 0) {
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                sleep_condition.notify_one();
             }
-            return pool_busy;
 #else
-            return false;
+            run_job(job);
+#endif
+        }
+        // Runs one job on the calling thread, if one can be found anywhere in the pool
+        auto try_run_one() -> bool {
+#if ENABLE_THREAD_POOL
+            auto job = Job{};
+            if (find_job(job)) {
+                run_job(job);
+                return true;
+            }
 #endif
+            return false;
         }
 
       private:
-        void thread_loop() {
+        friend struct TaskGroup;
+        static void run_job(Job const &job);
+
 #if ENABLE_THREAD_POOL
+        struct Worker {
+            JobDeque deque{};
+            std::thread thread{};
+        };
+
+        auto find_job(Job &job) -> bool {
+            auto const is_worker = current_pool == this;
+            if (is_worker && workers[current_worker_index]->deque.pop(job)) {
+                return true;
+            }
+            {
+                std::unique_lock<std::mutex> lock(injection_mutex);
+                if (!injected_jobs.empty()) {
+                    job = injected_jobs.front();
+                    injected_jobs.pop_front();
+                    return true;
+                }
+            }
+            auto const worker_n = static_cast<uint32_t>(workers.size());
+            auto const first_victim = is_worker ? current_worker_index + 1 : steal_seed++;
+            for (uint32_t i = 0; i < worker_n; ++i) {
+                auto const victim = (first_victim + i) % worker_n;
+                if ((!is_worker || victim != current_worker_index) && workers[victim]->deque.steal(job)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void thread_loop(uint32_t worker_index) {
+            current_pool = this;
+            current_worker_index = worker_index;
             while (true) {
-                std::function<void()> job;
-                {
-                    std::unique_lock<std::mutex> lock(queue_mutex);
-                    mutex_condition.wait(lock, [this] {
-                        return !jobs.empty() || should_terminate;
+                auto const epoch = work_epoch.load();
+                if (try_run_one()) {
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                if (should_terminate) {
+                    break;
+                }
+                // Anything submitted after `epoch` was read bumps it, so we can't miss it between the search and the wait
+                sleeper_n.fetch_add(1);
+                sleep_condition.wait(lock, [&] {
+                    return should_terminate || work_epoch.load() != epoch;
+                });
+                sleeper_n.fetch_sub(1);
+            }
+            current_pool = nullptr;
+        }
+
+        static inline thread_local ThreadPool *current_pool = nullptr;
+        static inline thread_local uint32_t current_worker_index = 0;
+        static inline thread_local uint32_t steal_seed = 0;
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::mutex injection_mutex;
+        std::deque<Job> injected_jobs;
+        std::atomic_uint64_t work_epoch{0};
+        std::atomic_uint32_t sleeper_n{0};
+        bool should_terminate = false;
+        std::mutex sleep_mutex;
+        std::condition_variable sleep_condition;
+        // Shared by every TaskGroup, since a group may be gone by the time its last job signals completion
+        std::mutex completion_mutex;
+        std::condition_variable completion_condition;
+#endif
+    };
+
+    // Tracks a set of jobs submitted to a pool, so that they can be waited on without waiting on anyone else's
+    struct TaskGroup {
+        explicit TaskGroup(ThreadPool &a_thread_pool) : thread_pool{a_thread_pool} {}
+        TaskGroup(TaskGroup const &) = delete;
+        TaskGroup(TaskGroup &&) = delete;
+        auto operator=(TaskGroup const &) -> TaskGroup & = delete;
+        auto operator=(TaskGroup &&) -> TaskGroup & = delete;
+        ~TaskGroup() {
+            wait();
+        }
+
+        template <typename F>
+        void run(F const &f) {
+#if ENABLE_THREAD_POOL
+            pending_n.fetch_add(1, std::memory_order_relaxed);
+            thread_pool.submit(Job::make(f, this));
+#else
+            f();
+#endif
+        }
+        // Helps with queued jobs (ours or not) until there are none left, then sleeps until ours are done
+        void wait() {
+#if ENABLE_THREAD_POOL
+            while (pending_n.load(std::memory_order_acquire) != 0) {
+                if (!thread_pool.try_run_one()) {
+                    std::unique_lock<std::mutex> lock(thread_pool.completion_mutex);
+                    thread_pool.completion_condition.wait(lock, [this] {
+                        return pending_n.load(std::memory_order_acquire) == 0;
                     });
-                    if (should_terminate) {
-                        return;
-                    }
-                    job = jobs.front();
-                    jobs.pop();
+                    return;
                 }
-                job();
             }
 #endif
         }
+
+      private:
+        friend struct ThreadPool;
+
+        void finish_one() {
 #if ENABLE_THREAD_POOL
-        bool should_terminate = false;
-        std::mutex queue_mutex;
-        std::condition_variable mutex_condition;
-        std::vector<std::thread> threads;
-        std::queue<std::function<void()>> jobs;
+            // The group may be destroyed as soon as the count reaches 0, so only the pool is touched after that
+            auto &pool = thread_pool;
+            if (pending_n.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::unique_lock<std::mutex> lock(pool.completion_mutex);
+                pool.completion_condition.notify_all();
+            }
+#endif
+        }
+
+        ThreadPool &thread_pool;
+#if ENABLE_THREAD_POOL
+        std::atomic_size_t pending_n{0};
 #endif
     };
+
+    inline void ThreadPool::run_job(Job const &job) {
+        job.invoke(job);
+        if (job.group != nullptr) {
+            job.group->finish_one();
+        }
+    }
+
+    namespace detail {
+        template <typename F>
+        void parallel_for_split(TaskGroup &group, uint32_t begin, uint32_t end, uint32_t grain, F const &fn) {
+            // Hand off the upper halves, so that idle workers steal large chunks and split them further themselves
+            while (end - begin > grain) {
+                auto const mid = begin + (end - begin) / 2;
+                group.run([&group, mid, end, grain, &fn]() {
+                    parallel_for_split(group, mid, end, grain, fn);
+                });
+                end = mid;
+            }
+            fn(begin, end);
+        }
+    } // namespace detail
+
+    // Calls `fn(chunk_begin, chunk_end)` over disjoint chunks of [begin, end), each at most `grain` long.
+    // Chunks run in no particular order, and the call returns once all of them have.
+    template <typename F>
+    void parallel_for(ThreadPool &thread_pool, uint32_t begin, uint32_t end, uint32_t grain, F const &fn) {
+        if (begin >= end) {
+            return;
+        }
+#if ENABLE_THREAD_POOL
+        auto group = TaskGroup{thread_pool};
+        detail::parallel_for_split(group, begin, end, std::max(grain, 1u), fn);
+        group.wait();
+#else
+        (void)thread_pool;
+        (void)grain;
+        fn(begin, end);
+#endif
+    }
+
+    // The pool owned by the adapter's GvoxContext, started on first use and shared by every blit on that context
+    auto get_thread_pool(GvoxAdapterContext *ctx) -> ThreadPool &;
 } // namespace gvox_detail::thread_pool
@@ -6,9 +6,12 @@
 #include <vector>
 #include <array>
 #include <algorithm>
+#include <bit>
 
 #include <mutex>
 
+#include "adapters/shared/thread_pool.hpp"
+
 #if __wasm32__
 #include "utils/patch_wasm.h"
 #endif
@@ -37,6 +40,8 @@ struct _GvoxContext {
 #if GVOX_ENABLE_THREADSAFETY
     std::mutex mtx{};
 #endif
+    uint32_t thread_count{0};
+    gvox_detail::thread_pool::ThreadPool thread_pool{};
 };
 struct _GvoxAdapterContext {
     GvoxContext *gvox_context_ptr;
@@ -88,6 +93,27 @@ void gvox_destroy_context(GvoxContext *ctx) {
     delete ctx;
 }
 
+void gvox_context_set_thread_count(GvoxContext *ctx, uint32_t thread_count) {
+#if GVOX_ENABLE_THREADSAFETY
+    auto lock = std::lock_guard{ctx->mtx};
+#endif
+    if (ctx->thread_count == thread_count) {
+        return;
+    }
+    ctx->thread_count = thread_count;
+    // The pool is restarted with the new size the next time an adapter asks for it
+    ctx->thread_pool.stop();
+}
+
+auto gvox_detail::thread_pool::get_thread_pool(GvoxAdapterContext *ctx) -> ThreadPool & {
+    auto &gvox_ctx = *ctx->gvox_context_ptr;
+#if GVOX_ENABLE_THREADSAFETY
+    auto lock = std::lock_guard{gvox_ctx.mtx};
+#endif
+    gvox_ctx.thread_pool.start(gvox_ctx.thread_count);
+    return gvox_ctx.thread_pool;
+}
+
 auto gvox_get_result(GvoxContext *ctx) -> GvoxResult {
     if (ctx->errors.empty()) {
         return GVOX_RESULT_SUCCESS;
@@ -235,12 +261,57 @@ void gvox_destroy_adapter_context(GvoxAdapterContext *ctx) {
     delete ctx;
 }
 
+// Multiple of every brick size used by the built-in serializers, so that no brick is ever shared between tiles
+static constexpr auto PARALLEL_BLIT_TILE_SIZE = uint32_t{32};
+
+static void serialize_region_parallel(GvoxBlitContext const &blit_ctx, GvoxRegionRange const &range, uint32_t channel_flags) {
+    auto &s_adapter = *reinterpret_cast<GvoxSerializeAdapter *>(blit_ctx.s_ctx->adapter);
+    auto const tile_nx = (range.extent.x + PARALLEL_BLIT_TILE_SIZE - 1) / PARALLEL_BLIT_TILE_SIZE;
+    auto const tile_ny = (range.extent.y + PARALLEL_BLIT_TILE_SIZE - 1) / PARALLEL_BLIT_TILE_SIZE;
+    auto const tile_nz = (range.extent.z + PARALLEL_BLIT_TILE_SIZE - 1) / PARALLEL_BLIT_TILE_SIZE;
+    auto const tile_n = tile_nx * tile_ny * tile_nz;
+    if (tile_n == 0) {
+        return;
+    }
+    auto serialize_tile = [&](GvoxBlitContext *tile_blit_ctx, uint32_t tile_i) {
+        auto const tx = tile_i % tile_nx;
+        auto const ty = (tile_i / tile_nx) % tile_ny;
+        auto const tz = tile_i / (tile_nx * tile_ny);
+        auto const tile_range = GvoxRegionRange{
+            .offset = {
+                range.offset.x + static_cast<int32_t>(tx * PARALLEL_BLIT_TILE_SIZE),
+                range.offset.y + static_cast<int32_t>(ty * PARALLEL_BLIT_TILE_SIZE),
+                range.offset.z + static_cast<int32_t>(tz * PARALLEL_BLIT_TILE_SIZE),
+            },
+            .extent = {
+                std::min(PARALLEL_BLIT_TILE_SIZE, range.extent.x - tx * PARALLEL_BLIT_TILE_SIZE),
+                std::min(PARALLEL_BLIT_TILE_SIZE, range.extent.y - ty * PARALLEL_BLIT_TILE_SIZE),
+                std::min(PARALLEL_BLIT_TILE_SIZE, range.extent.z - tz * PARALLEL_BLIT_TILE_SIZE),
+            },
+        };
+        s_adapter.info.serialize_region(tile_blit_ctx, tile_blit_ctx->s_ctx, &tile_range, channel_flags);
+    };
+    auto &thread_pool = gvox_detail::thread_pool::get_thread_pool(blit_ctx.s_ctx);
+    // One layer of tiles at a time, so that a serializer that writes its output out in z order as it completes
+    // doesn't have to hold on to everything handled out of order
+    auto const layer_tile_n = tile_nx * tile_ny;
+    for (uint32_t tz = 0; tz < tile_nz; ++tz) {
+        gvox_detail::thread_pool::parallel_for(thread_pool, tz * layer_tile_n, (tz + 1) * layer_tile_n, 1, [&](uint32_t tile_begin, uint32_t tile_end) {
+            auto tile_blit_ctx = blit_ctx;
+            for (uint32_t tile_i = tile_begin; tile_i < tile_end; ++tile_i) {
+                serialize_tile(&tile_blit_ctx, tile_i);
+            }
+        });
+    }
+}
+
 static void gvox_blit_region_impl(
     GvoxAdapterContext *input_ctx, GvoxAdapterContext *output_ctx,
     GvoxAdapterContext *parse_ctx, GvoxAdapterContext *serialize_ctx,
     GvoxRegionRange const *requested_range,
     uint32_t channel_flags,
-    GvoxBlitMode blit_mode) {
+    GvoxBlitMode blit_mode,
+    bool is_parallel = false) {
     if (parse_ctx->adapter == nullptr) {
         gvox_adapter_push_error(serialize_ctx, GVOX_RESULT_ERROR_INVALID_PARAMETER, "[BLIT ERROR]: The parse adapter mustn't be null");
         return;
@@ -275,7 +346,11 @@ static void gvox_blit_region_impl(
         reinterpret_cast<GvoxParseAdapter *>(parse_ctx->adapter)->info.parse_region(&blit_ctx, parse_ctx, &actual_range, channel_flags);
         break;
     case GVOX_BLIT_MODE_SERIALIZE_DRIVEN:
-        reinterpret_cast<GvoxSerializeAdapter *>(serialize_ctx->adapter)->info.serialize_region(&blit_ctx, serialize_ctx, &actual_range, channel_flags);
+        if (is_parallel) {
+            serialize_region_parallel(blit_ctx, actual_range, channel_flags);
+        } else {
+            reinterpret_cast<GvoxSerializeAdapter *>(serialize_ctx->adapter)->info.serialize_region(&blit_ctx, serialize_ctx, &actual_range, channel_flags);
+        }
         break;
     }
     gvox_adapter_blit_end(&blit_ctx, blit_ctx.s_ctx);
@@ -334,6 +409,41 @@ void gvox_blit_region_serialize_driven(
         GVOX_BLIT_MODE_SERIALIZE_DRIVEN);
 }
 
+void gvox_blit_region_parallel(
+    GvoxAdapterContext *input_ctx, GvoxAdapterContext *output_ctx,
+    GvoxAdapterContext *parse_ctx, GvoxAdapterContext *serialize_ctx,
+    GvoxRegionRange const *requested_range,
+    uint32_t channel_flags) {
+    if (parse_ctx->adapter == nullptr) {
+        gvox_adapter_push_error(serialize_ctx, GVOX_RESULT_ERROR_INVALID_PARAMETER, "[BLIT ERROR]: The parse adapter mustn't be null");
+        return;
+    }
+    if (serialize_ctx->adapter == nullptr) {
+        gvox_adapter_push_error(serialize_ctx, GVOX_RESULT_ERROR_INVALID_PARAMETER, "[BLIT ERROR]: The serialize adapter mustn't be null");
+        return;
+    }
+    auto *parse_adapter = reinterpret_cast<GvoxParseAdapter *>(parse_ctx->adapter);
+    auto *serialize_adapter = reinterpret_cast<GvoxSerializeAdapter *>(serialize_ctx->adapter);
+    auto const supports_concurrent_sampling =
+        parse_adapter->info.query_details != nullptr &&
+        parse_adapter->info.query_details().supports_concurrent_sampling != 0;
+    auto const supports_concurrent_serialization =
+        serialize_adapter->info.query_details != nullptr &&
+        serialize_adapter->info.query_details().supports_concurrent_serialization != 0;
+    if (!supports_concurrent_sampling || !supports_concurrent_serialization) {
+        gvox_blit_region(input_ctx, output_ctx, parse_ctx, serialize_ctx, requested_range, channel_flags);
+        return;
+    }
+
+    gvox_blit_region_impl(
+        input_ctx, output_ctx,
+        parse_ctx, serialize_ctx,
+        requested_range,
+        channel_flags,
+        GVOX_BLIT_MODE_SERIALIZE_DRIVEN,
+        true);
+}
+
 // Adapter API
 
 // Input
@@ -341,6 +451,13 @@ void gvox_input_read(GvoxBlitContext *blit_ctx, size_t position, size_t size, vo
     auto &i_adapter = *reinterpret_cast<GvoxInputAdapter *>(blit_ctx->i_ctx->adapter);
     i_adapter.info.read(reinterpret_cast<GvoxAdapterContext *>(blit_ctx->i_ctx), position, size, data);
 }
+auto gvox_input_view(GvoxBlitContext *blit_ctx, size_t position, size_t size) -> void const * {
+    auto &i_adapter = *reinterpret_cast<GvoxInputAdapter *>(blit_ctx->i_ctx->adapter);
+    if (i_adapter.info.view == nullptr) {
+        return nullptr;
+    }
+    return i_adapter.info.view(reinterpret_cast<GvoxAdapterContext *>(blit_ctx->i_ctx), position, size);
+}
 // Output
 void gvox_output_write(GvoxBlitContext *blit_ctx, size_t position, size_t size, void const *data) {
     auto &o_adapter = *reinterpret_cast<GvoxOutputAdapter *>(blit_ctx->o_ctx->adapter);
@@ -371,6 +488,70 @@ auto gvox_sample_region(GvoxBlitContext *blit_ctx, GvoxRegion const *region, Gvo
     auto offset_copy = *offset;
     return p_adapter.info.sample_region(blit_ctx, reinterpret_cast<GvoxAdapterContext *>(blit_ctx->p_ctx), region, &offset_copy, channel_id);
 }
+void gvox_sample_region_batch(GvoxBlitContext *blit_ctx, GvoxRegion const *region, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_id) {
+    auto &p_adapter = *reinterpret_cast<GvoxParseAdapter *>(blit_ctx->p_ctx->adapter);
+    if (p_adapter.info.sample_region_batch != nullptr) {
+        p_adapter.info.sample_region_batch(blit_ctx, reinterpret_cast<GvoxAdapterContext *>(blit_ctx->p_ctx), region, offsets, samples, sample_n, channel_id);
+        return;
+    }
+    for (uint32_t i = 0; i < sample_n; ++i) {
+        auto offset_copy = offsets[i];
+        samples[i] = p_adapter.info.sample_region(blit_ctx, reinterpret_cast<GvoxAdapterContext *>(blit_ctx->p_ctx), region, &offset_copy, channel_id);
+    }
+}
+void gvox_sample_region_channels(GvoxBlitContext *blit_ctx, GvoxRegion const *region, GvoxOffset3D const *offsets, GvoxSample *samples, uint32_t sample_n, uint32_t channel_flags) {
+    auto &p_adapter = *reinterpret_cast<GvoxParseAdapter *>(blit_ctx->p_ctx->adapter);
+    if (p_adapter.info.sample_region_channels != nullptr) {
+        p_adapter.info.sample_region_channels(blit_ctx, reinterpret_cast<GvoxAdapterContext *>(blit_ctx->p_ctx), region, offsets, samples, sample_n, channel_flags);
+        return;
+    }
+    auto const channel_n = static_cast<uint32_t>(std::popcount(channel_flags));
+    auto channel_samples = std::vector<GvoxSample>(sample_n);
+    uint32_t channel_i = 0;
+    for (uint32_t channel_id = 0; channel_id < 32; ++channel_id) {
+        if (((channel_flags >> channel_id) & 0x1) == 0) {
+            continue;
+        }
+        gvox_sample_region_batch(blit_ctx, region, offsets, channel_samples.data(), sample_n, channel_id);
+        for (uint32_t i = 0; i < sample_n; ++i) {
+            samples[i * channel_n + channel_i] = channel_samples[i];
+        }
+        ++channel_i;
+    }
+}
+auto gvox_load_region_dense(GvoxBlitContext *blit_ctx, GvoxRegionRange const *range, uint32_t channel_id, uint32_t *data, GvoxStrides3D const *strides) -> uint8_t {
+    auto &p_adapter = *reinterpret_cast<GvoxParseAdapter *>(blit_ctx->p_ctx->adapter);
+    auto const packed_strides = GvoxStrides3D{1, range->extent.x, size_t{range->extent.x} * range->extent.y};
+    if (strides == nullptr) {
+        strides = &packed_strides;
+    }
+    if (p_adapter.info.load_region_dense != nullptr) {
+        return p_adapter.info.load_region_dense(blit_ctx, reinterpret_cast<GvoxAdapterContext *>(blit_ctx->p_ctx), range, channel_id, data, strides);
+    }
+    auto region = gvox_load_region_range(blit_ctx, range, 1u << channel_id);
+    auto offsets = std::vector<GvoxOffset3D>(range->extent.x);
+    auto samples = std::vector<GvoxSample>(range->extent.x);
+    auto all_present = true;
+    for (uint32_t zi = 0; zi < range->extent.z; ++zi) {
+        for (uint32_t yi = 0; yi < range->extent.y; ++yi) {
+            for (uint32_t xi = 0; xi < range->extent.x; ++xi) {
+                offsets[xi] = {
+                    range->offset.x + static_cast<int32_t>(xi),
+                    range->offset.y + static_cast<int32_t>(yi),
+                    range->offset.z + static_cast<int32_t>(zi),
+                };
+            }
+            gvox_sample_region_batch(blit_ctx, &region, offsets.data(), samples.data(), range->extent.x, channel_id);
+            auto *row = data + yi * strides->y + zi * strides->z;
+            for (uint32_t xi = 0; xi < range->extent.x; ++xi) {
+                all_present = all_present && (samples[xi].is_present != 0u);
+                row[xi * strides->x] = samples[xi].is_present != 0u ? samples[xi].data : 0u;
+            }
+        }
+    }
+    gvox_unload_region_range(blit_ctx, &region, range);
+    return static_cast<uint8_t>(all_present);
+}
 
 // Serialize Driven
 auto gvox_query_region_flags(GvoxBlitContext *blit_ctx, GvoxRegionRange const *range, uint32_t channel_flags) -> uint32_t {
@@ -53,6 +53,7 @@ extern "C" void procedural_blit_end(GvoxBlitContext * /*unused*/, GvoxAdapterCon
 extern "C" auto procedural_query_details() -> GvoxParseAdapterDetails {
     return {
         .preferred_blit_mode = GVOX_BLIT_MODE_SERIALIZE_DRIVEN,
+        .supports_concurrent_sampling = 1,
     };
 }
 
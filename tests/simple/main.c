@@ -8,11 +8,13 @@
 #include <adapters/procedural.h>
 #include <gvox/adapters/parse/voxlap.h>
 #include <gvox/adapters/serialize/gvox_raw.h>
+#include <gvox/adapters/serialize/gvox_palette.h>
 #include <gvox/adapters/serialize/colored_text.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
 #include <time.h>
 
 void handle_gvox_error(GvoxContext *gvox_ctx) {
@@ -405,6 +407,397 @@ void test_voxlap(void) {
     gvox_destroy_context(gvox_ctx);
 }
 
+typedef void (*GvoxBlitFunc)(GvoxAdapterContext *, GvoxAdapterContext *, GvoxAdapterContext *, GvoxAdapterContext *, GvoxRegionRange const *, uint32_t);
+
+// Round trip tests use a range that isn't aligned to any brick size, so that partial bricks get tested too
+static GvoxRegionRange const round_trip_range = {
+    .offset = {-13, -7, -21},
+    .extent = {+45, +40, +50},
+};
+static uint32_t const round_trip_channels = GVOX_CHANNEL_BIT_COLOR | GVOX_CHANNEL_BIT_NORMAL | GVOX_CHANNEL_BIT_MATERIAL_ID;
+
+GvoxAdapter *register_procedural_adapter(GvoxContext *gvox_ctx) {
+    GvoxParseAdapterInfo procedural_adapter_info = {
+        .base_info = {
+            .name_str = "procedural",
+            .create = procedural_create,
+            .destroy = procedural_destroy,
+            .blit_begin = procedural_blit_begin,
+            .blit_end = procedural_blit_end,
+        },
+        .query_details = procedural_query_details,
+        .query_region_flags = procedural_query_region_flags,
+        .load_region = procedural_load_region,
+        .unload_region = procedural_unload_region,
+        .sample_region = procedural_sample_region,
+        .parse_region = procedural_parse_region,
+    };
+    return gvox_register_parse_adapter(gvox_ctx, &procedural_adapter_info);
+}
+
+// Serializes the round trip range into a new buffer, taking the voxels from `source_raw_data` (a gvox_raw buffer) if
+// it's set, and from the procedural adapter otherwise
+void encode_round_trip_source(GvoxContext *gvox_ctx, GvoxAdapter *procedural_adapter, uint8_t const *source_raw_data, size_t source_raw_size, char const *serialize_adapter_name, void const *s_config, GvoxBlitFunc blit_func, uint8_t **data, size_t *size) {
+    GvoxByteBufferInputAdapterConfig i_config = {
+        .data = source_raw_data,
+        .size = source_raw_size,
+    };
+    GvoxByteBufferOutputAdapterConfig o_config = {
+        .out_byte_buffer_ptr = data,
+        .out_size = size,
+        .allocate = NULL,
+    };
+    GvoxAdapterContext *i_ctx = NULL;
+    GvoxAdapterContext *p_ctx = NULL;
+    if (source_raw_data != NULL) {
+        i_ctx = gvox_create_adapter_context(gvox_ctx, gvox_get_input_adapter(gvox_ctx, "byte_buffer"), &i_config);
+        p_ctx = gvox_create_adapter_context(gvox_ctx, gvox_get_parse_adapter(gvox_ctx, "gvox_raw"), NULL);
+    } else {
+        p_ctx = gvox_create_adapter_context(gvox_ctx, procedural_adapter, NULL);
+    }
+    GvoxAdapterContext *o_ctx = gvox_create_adapter_context(gvox_ctx, gvox_get_output_adapter(gvox_ctx, "byte_buffer"), &o_config);
+    GvoxAdapterContext *s_ctx = gvox_create_adapter_context(gvox_ctx, gvox_get_serialize_adapter(gvox_ctx, serialize_adapter_name), s_config);
+    blit_func(i_ctx, o_ctx, p_ctx, s_ctx, &round_trip_range, round_trip_channels);
+    if (i_ctx != NULL) {
+        gvox_destroy_adapter_context(i_ctx);
+    }
+    gvox_destroy_adapter_context(o_ctx);
+    gvox_destroy_adapter_context(p_ctx);
+    gvox_destroy_adapter_context(s_ctx);
+    handle_gvox_error(gvox_ctx);
+}
+
+// Parses `data` and serializes the round trip range of `channel_flags` of it as a plain gvox_raw buffer
+void decode_to_raw(GvoxContext *gvox_ctx, char const *parse_adapter_name, uint8_t const *data, size_t size, uint32_t channel_flags, GvoxBlitFunc blit_func, uint8_t **raw_data, size_t *raw_size) {
+    GvoxByteBufferInputAdapterConfig i_config = {
+        .data = data,
+        .size = size,
+    };
+    GvoxByteBufferOutputAdapterConfig o_config = {
+        .out_byte_buffer_ptr = raw_data,
+        .out_size = raw_size,
+        .allocate = NULL,
+    };
+    GvoxAdapterContext *i_ctx = gvox_create_adapter_context(gvox_ctx, gvox_get_input_adapter(gvox_ctx, "byte_buffer"), &i_config);
+    GvoxAdapterContext *o_ctx = gvox_create_adapter_context(gvox_ctx, gvox_get_output_adapter(gvox_ctx, "byte_buffer"), &o_config);
+    GvoxAdapterContext *p_ctx = gvox_create_adapter_context(gvox_ctx, gvox_get_parse_adapter(gvox_ctx, parse_adapter_name), NULL);
+    GvoxAdapterContext *s_ctx = gvox_create_adapter_context(gvox_ctx, gvox_get_serialize_adapter(gvox_ctx, "gvox_raw"), NULL);
+    blit_func(i_ctx, o_ctx, p_ctx, s_ctx, &round_trip_range, channel_flags);
+    gvox_destroy_adapter_context(i_ctx);
+    gvox_destroy_adapter_context(o_ctx);
+    gvox_destroy_adapter_context(p_ctx);
+    gvox_destroy_adapter_context(s_ctx);
+    handle_gvox_error(gvox_ctx);
+}
+
+// Encodes the round trip range of `source_raw_data` (or the procedural adapter, if that's null) with `s_config`
+// (through `encode_func`), and checks that decoding it serialize driven, parse driven and in parallel gives the same
+// voxels as encoding it with `plain_s_config` does
+void test_round_trip_from(uint8_t const *source_raw_data, size_t source_raw_size, char const *format_name, void const *s_config, void const *plain_s_config, GvoxBlitFunc encode_func) {
+    GvoxContext *gvox_ctx = gvox_create_context();
+    GvoxAdapter *procedural_adapter = register_procedural_adapter(gvox_ctx);
+
+    uint8_t *expected_data = NULL;
+    size_t expected_size = 0;
+    {
+        uint8_t *plain_data = NULL;
+        size_t plain_size = 0;
+        encode_round_trip_source(gvox_ctx, procedural_adapter, source_raw_data, source_raw_size, format_name, plain_s_config, gvox_blit_region_serialize_driven, &plain_data, &plain_size);
+        decode_to_raw(gvox_ctx, format_name, plain_data, plain_size, round_trip_channels, gvox_blit_region_serialize_driven, &expected_data, &expected_size);
+        free(plain_data);
+    }
+
+    uint8_t *data = NULL;
+    size_t size = 0;
+    encode_round_trip_source(gvox_ctx, procedural_adapter, source_raw_data, source_raw_size, format_name, s_config, encode_func, &data, &size);
+
+    GvoxBlitFunc const decode_funcs[] = {gvox_blit_region_serialize_driven, gvox_blit_region_parse_driven, gvox_blit_region_parallel};
+    for (size_t i = 0; i < sizeof(decode_funcs) / sizeof(decode_funcs[0]); ++i) {
+        uint8_t *raw_data = NULL;
+        size_t raw_size = 0;
+        decode_to_raw(gvox_ctx, format_name, data, size, round_trip_channels, decode_funcs[i], &raw_data, &raw_size);
+        assert(raw_size == expected_size);
+        assert(memcmp(raw_data, expected_data, raw_size) == 0);
+        free(raw_data);
+    }
+
+    free(data);
+    free(expected_data);
+    gvox_destroy_context(gvox_ctx);
+}
+
+void test_round_trip(char const *format_name, void const *s_config, void const *plain_s_config, GvoxBlitFunc encode_func) {
+    test_round_trip_from(NULL, 0, format_name, s_config, plain_s_config, encode_func);
+}
+
+// The procedural voxels as a gvox_raw buffer, with the color of every other 8^3 brick replaced by noise. Those bricks
+// still get palettes, but their indices can't be compressed.
+void create_noisy_raw_source(uint8_t **data, size_t *size) {
+    GvoxContext *gvox_ctx = gvox_create_context();
+    GvoxAdapter *procedural_adapter = register_procedural_adapter(gvox_ctx);
+    encode_round_trip_source(gvox_ctx, procedural_adapter, NULL, 0, "gvox_raw", NULL, gvox_blit_region_serialize_driven, data, size);
+    gvox_destroy_context(gvox_ctx);
+
+    size_t const channel_n = 3;
+    size_t const voxel_n = (size_t)round_trip_range.extent.x * round_trip_range.extent.y * round_trip_range.extent.z;
+    uint8_t *voxels = *data + (*size - voxel_n * channel_n * sizeof(uint32_t));
+    uint32_t rng_state = 12345;
+    for (uint32_t zi = 0; zi < round_trip_range.extent.z; ++zi) {
+        for (uint32_t yi = 0; yi < round_trip_range.extent.y; ++yi) {
+            for (uint32_t xi = 0; xi < round_trip_range.extent.x; ++xi) {
+                rng_state = rng_state * 1664525u + 1013904223u;
+                if ((((xi / 8) ^ (yi / 8) ^ (zi / 8)) & 1) == 0) {
+                    continue;
+                }
+                size_t const voxel_i = xi + yi * round_trip_range.extent.x + zi * round_trip_range.extent.x * round_trip_range.extent.y;
+                uint32_t const color = (rng_state >> 25) * 0x01030507u;
+                // Color is the first channel
+                memcpy(voxels + voxel_i * channel_n * sizeof(uint32_t), &color, sizeof(color));
+            }
+        }
+    }
+}
+
+void test_parallel_blit(void) {
+    test_round_trip("gvox_raw", NULL, NULL, gvox_blit_region_parallel);
+    test_round_trip("gvox_palette", NULL, NULL, gvox_blit_region_parallel);
+}
+
+void test_palette_versions(void) {
+    GvoxGvoxPaletteSerializeAdapterConfig v2_config = {
+        .version = 2,
+    };
+    test_round_trip("gvox_palette", &v2_config, NULL, gvox_blit_region_serialize_driven);
+    GvoxGvoxPaletteSerializeAdapterConfig v3_config = {
+        .version = 3,
+    };
+    test_round_trip("gvox_palette", &v3_config, NULL, gvox_blit_region_serialize_driven);
+}
+
+void test_palette_compression(void) {
+    GvoxGvoxPaletteSerializeAdapterConfig s_config = {
+        .version = 2,
+        .compression = GVOX_GVOX_PALETTE_SERIALIZE_ADAPTER_COMPRESSION_LZ,
+    };
+    test_round_trip("gvox_palette", &s_config, NULL, gvox_blit_region_serialize_driven);
+
+    // Bricks that don't compress are stored as is, after ones that did
+    uint8_t *noisy_data = NULL;
+    size_t noisy_size = 0;
+    create_noisy_raw_source(&noisy_data, &noisy_size);
+    test_round_trip_from(noisy_data, noisy_size, "gvox_palette", &s_config, NULL, gvox_blit_region_serialize_driven);
+    free(noisy_data);
+}
+
+void test_palette_streaming(void) {
+    GvoxGvoxPaletteSerializeAdapterConfig s_config = {
+        .version = 1,
+        .streaming = 1,
+    };
+    test_round_trip("gvox_palette", &s_config, NULL, gvox_blit_region_serialize_driven);
+    GvoxGvoxPaletteSerializeAdapterConfig compressed_s_config = {
+        .version = 2,
+        .compression = GVOX_GVOX_PALETTE_SERIALIZE_ADAPTER_COMPRESSION_LZ,
+        .streaming = 1,
+    };
+    test_round_trip("gvox_palette", &compressed_s_config, NULL, gvox_blit_region_serialize_driven);
+}
+
+void test_palette_brick_sizes(void) {
+    uint32_t const brick_sizes[] = {16, 32};
+    for (size_t i = 0; i < sizeof(brick_sizes) / sizeof(brick_sizes[0]); ++i) {
+        GvoxGvoxPaletteSerializeAdapterConfig s_config = {
+            .version = 3,
+            .brick_size = brick_sizes[i],
+        };
+        test_round_trip("gvox_palette", &s_config, NULL, gvox_blit_region_serialize_driven);
+    }
+}
+
+void test_raw_planar_layout(void) {
+    GvoxGvoxRawSerializeAdapterConfig s_config = {
+        .layout = GVOX_GVOX_RAW_SERIALIZE_ADAPTER_LAYOUT_PLANAR,
+    };
+    test_round_trip("gvox_raw", &s_config, NULL, gvox_blit_region_serialize_driven);
+}
+
+void test_raw_streaming(void) {
+    GvoxGvoxRawSerializeAdapterConfig s_config = {
+        .streaming = 1,
+        .slab_size = 16,
+    };
+    test_round_trip("gvox_raw", &s_config, NULL, gvox_blit_region_serialize_driven);
+    // Planar files fall back to being written all at once
+    GvoxGvoxRawSerializeAdapterConfig planar_s_config = {
+        .layout = GVOX_GVOX_RAW_SERIALIZE_ADAPTER_LAYOUT_PLANAR,
+        .streaming = 1,
+        .slab_size = 16,
+    };
+    test_round_trip("gvox_raw", &planar_s_config, NULL, gvox_blit_region_serialize_driven);
+}
+
+static void put_vox_u32(uint8_t *vox, size_t *size, uint32_t value) {
+    memcpy(vox + *size, &value, sizeof(value));
+    *size += sizeof(value);
+}
+
+static void put_vox_string(uint8_t *vox, size_t *size, char const *str) {
+    put_vox_u32(vox, size, (uint32_t)strlen(str));
+    memcpy(vox + *size, str, strlen(str));
+    *size += strlen(str);
+}
+
+// Writes a chunk header, whose sizes are filled in once the chunk is done by end_vox_chunk
+static size_t begin_vox_chunk(uint8_t *vox, size_t *size, char const *chunk_id) {
+    size_t const chunk_offset = *size;
+    memcpy(vox + *size, chunk_id, 4);
+    *size += 4;
+    put_vox_u32(vox, size, 0);
+    put_vox_u32(vox, size, 0);
+    return chunk_offset;
+}
+
+static void end_vox_chunk(uint8_t *vox, size_t size, size_t chunk_offset, int has_children) {
+    uint32_t const body_size = (uint32_t)(size - chunk_offset - 12);
+    size_t header_size = chunk_offset + 4;
+    put_vox_u32(vox, &header_size, has_children ? 0 : body_size);
+    put_vox_u32(vox, &header_size, has_children ? body_size : 0);
+}
+
+// A magicavoxel scene of 8^3 models in a row, each one overlapping half of the next. Every other model is a
+// checkerboard, so that the voxels underneath show through it. The buffer must hold at least 16KiB.
+static size_t create_overlapping_vox(uint8_t *vox) {
+    uint32_t const instance_n = 10;
+    size_t size = 0;
+    memcpy(vox, "VOX ", 4);
+    size += 4;
+    put_vox_u32(vox, &size, 150);
+    size_t const main_chunk = begin_vox_chunk(vox, &size, "MAIN");
+    for (uint32_t model_i = 0; model_i < 2; ++model_i) {
+        size_t chunk = begin_vox_chunk(vox, &size, "SIZE");
+        put_vox_u32(vox, &size, 8);
+        put_vox_u32(vox, &size, 8);
+        put_vox_u32(vox, &size, 8);
+        end_vox_chunk(vox, size, chunk, 0);
+        chunk = begin_vox_chunk(vox, &size, "XYZI");
+        size_t const voxel_n_offset = size;
+        uint32_t voxel_n = 0;
+        put_vox_u32(vox, &size, 0);
+        for (uint8_t z = 0; z < 8; ++z) {
+            for (uint8_t y = 0; y < 8; ++y) {
+                for (uint8_t x = 0; x < 8; ++x) {
+                    if (model_i == 1 && ((x + y + z) & 1) != 0) {
+                        continue;
+                    }
+                    uint8_t const voxel[4] = {x, y, z, (uint8_t)(model_i == 0 ? 1 + x : 100 + z)};
+                    memcpy(vox + size, voxel, sizeof(voxel));
+                    size += sizeof(voxel);
+                    ++voxel_n;
+                }
+            }
+        }
+        size_t voxel_n_size = voxel_n_offset;
+        put_vox_u32(vox, &voxel_n_size, voxel_n);
+        end_vox_chunk(vox, size, chunk, 0);
+    }
+    size_t chunk = begin_vox_chunk(vox, &size, "nTRN");
+    put_vox_u32(vox, &size, 0);
+    put_vox_u32(vox, &size, 0);
+    put_vox_u32(vox, &size, 1);
+    put_vox_u32(vox, &size, UINT32_MAX);
+    put_vox_u32(vox, &size, 0);
+    put_vox_u32(vox, &size, 1);
+    put_vox_u32(vox, &size, 0);
+    end_vox_chunk(vox, size, chunk, 0);
+    chunk = begin_vox_chunk(vox, &size, "nGRP");
+    put_vox_u32(vox, &size, 1);
+    put_vox_u32(vox, &size, 0);
+    put_vox_u32(vox, &size, instance_n);
+    for (uint32_t instance_i = 0; instance_i < instance_n; ++instance_i) {
+        put_vox_u32(vox, &size, 2 + instance_i * 2);
+    }
+    end_vox_chunk(vox, size, chunk, 0);
+    for (uint32_t instance_i = 0; instance_i < instance_n; ++instance_i) {
+        char translation[32];
+        snprintf(translation, sizeof(translation), "%d %d 0", -12 + (int)instance_i * 4, (int)(instance_i % 3));
+        chunk = begin_vox_chunk(vox, &size, "nTRN");
+        put_vox_u32(vox, &size, 2 + instance_i * 2);
+        put_vox_u32(vox, &size, 0);
+        put_vox_u32(vox, &size, 3 + instance_i * 2);
+        put_vox_u32(vox, &size, UINT32_MAX);
+        put_vox_u32(vox, &size, 0);
+        put_vox_u32(vox, &size, 1);
+        put_vox_u32(vox, &size, 1);
+        put_vox_string(vox, &size, "_t");
+        put_vox_string(vox, &size, translation);
+        end_vox_chunk(vox, size, chunk, 0);
+        chunk = begin_vox_chunk(vox, &size, "nSHP");
+        put_vox_u32(vox, &size, 3 + instance_i * 2);
+        put_vox_u32(vox, &size, 0);
+        put_vox_u32(vox, &size, 1);
+        put_vox_u32(vox, &size, instance_i % 2);
+        put_vox_u32(vox, &size, 0);
+        end_vox_chunk(vox, size, chunk, 0);
+    }
+    end_vox_chunk(vox, size, main_chunk, 1);
+    return size;
+}
+
+// Wherever instances overlap, every blit into every serializer has to agree on which one's voxel ends up there
+void test_magicavoxel_overlapping_instances(void) {
+    GvoxContext *gvox_ctx = gvox_create_context();
+    static uint8_t vox[16384];
+    size_t const vox_size = create_overlapping_vox(vox);
+
+    uint32_t const channel_flags = GVOX_CHANNEL_BIT_COLOR | GVOX_CHANNEL_BIT_MATERIAL_ID;
+    char const *const format_names[] = {"gvox_raw", "gvox_palette"};
+    GvoxBlitFunc const encode_funcs[] = {gvox_blit_region_serialize_driven, gvox_blit_region_parse_driven, gvox_blit_region_parallel};
+    uint8_t *expected_data = NULL;
+    size_t expected_size = 0;
+    for (size_t format_i = 0; format_i < sizeof(format_names) / sizeof(format_names[0]); ++format_i) {
+        for (size_t encode_i = 0; encode_i < sizeof(encode_funcs) / sizeof(encode_funcs[0]); ++encode_i) {
+            uint8_t *data = NULL;
+            size_t size = 0;
+            {
+                GvoxByteBufferInputAdapterConfig i_config = {
+                    .data = vox,
+                    .size = vox_size,
+                };
+                GvoxByteBufferOutputAdapterConfig o_config = {
+                    .out_byte_buffer_ptr = &data,
+                    .out_size = &size,
+                    .allocate = NULL,
+                };
+                GvoxAdapterContext *i_ctx = gvox_create_adapter_context(gvox_ctx, gvox_get_input_adapter(gvox_ctx, "byte_buffer"), &i_config);
+                GvoxAdapterContext *o_ctx = gvox_create_adapter_context(gvox_ctx, gvox_get_output_adapter(gvox_ctx, "byte_buffer"), &o_config);
+                GvoxAdapterContext *p_ctx = gvox_create_adapter_context(gvox_ctx, gvox_get_parse_adapter(gvox_ctx, "magicavoxel"), NULL);
+                GvoxAdapterContext *s_ctx = gvox_create_adapter_context(gvox_ctx, gvox_get_serialize_adapter(gvox_ctx, format_names[format_i]), NULL);
+                encode_funcs[encode_i](i_ctx, o_ctx, p_ctx, s_ctx, &round_trip_range, channel_flags);
+                gvox_destroy_adapter_context(i_ctx);
+                gvox_destroy_adapter_context(o_ctx);
+                gvox_destroy_adapter_context(p_ctx);
+                gvox_destroy_adapter_context(s_ctx);
+                handle_gvox_error(gvox_ctx);
+            }
+            uint8_t *raw_data = NULL;
+            size_t raw_size = 0;
+            decode_to_raw(gvox_ctx, format_names[format_i], data, size, channel_flags, gvox_blit_region_serialize_driven, &raw_data, &raw_size);
+            free(data);
+            if (expected_data == NULL) {
+                expected_data = raw_data;
+                expected_size = raw_size;
+                continue;
+            }
+            assert(raw_size == expected_size);
+            assert(memcmp(raw_data, expected_data, raw_size) == 0);
+            free(raw_data);
+        }
+    }
+
+    free(expected_data);
+    gvox_destroy_context(gvox_ctx);
+}
+
 void test_speed(void) {
     GvoxContext *gvox_ctx = gvox_create_context();
 
@@ -472,5 +865,13 @@ int main(void) {
     test_palette_file_io();
     test_magicavoxel();
     test_voxlap();
+    test_parallel_blit();
+    test_palette_versions();
+    test_palette_compression();
+    test_palette_streaming();
+    test_palette_brick_sizes();
+    test_raw_planar_layout();
+    test_raw_streaming();
+    test_magicavoxel_overlapping_instances();
     // test_speed();
 }